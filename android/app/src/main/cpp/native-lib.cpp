@@ -1,10 +1,122 @@
+#include "wav-reader.h"
+#include "whisper-engine.h"
+#include "whisper-stream.h"
 #include "whisper/whisper.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <jni.h>
 #include <string>
 #include <vector>
 
 // ... (imports)
 
+// FIX 4: Silence detection
+// The mean-abs energy is gathered while the WAV file is decoded, so this no
+// longer needs its own pass over the samples.
+static bool is_silence(const audio_stats &stats) {
+  return stats.mean_abs() < 0.002f;
+}
+
+// Silence kept between two speech segments once the gap is cut out, so the
+// last word of one does not run into the first word of the next.
+#define VAD_GAP_MS 100
+
+// Drops leading/trailing silence and long pauses before inference. Whisper
+// encodes a full 30 s window per chunk of audio no matter how much of it is
+// speech, so long recordings with pauses need fewer encoder passes.
+// If the VAD finds no speech the audio is left as is: is_silence already
+// decided there is signal, and on a short clip that is mostly speech the noise
+// floor estimate sits close to the speech itself, which would drop a quiet
+// one-word answer entirely.
+static void trim_to_speech(std::vector<float> &pcmf32) {
+  const std::vector<audio_interval> speech = audio_vad_detect(
+      pcmf32.data(), pcmf32.size(), WHISPER_SAMPLE_RATE, audio_vad_params());
+  if (speech.empty()) {
+    return;
+  }
+
+  // Compact in place: merged segments are further apart than the gap, so the
+  // write position never overtakes the read position.
+  const int64_t n_gap = (int64_t)VAD_GAP_MS * WHISPER_SAMPLE_RATE / 1000;
+
+  int64_t n_out = 0;
+  for (size_t i = 0; i < speech.size(); i++) {
+    if (i > 0) {
+      std::fill(pcmf32.begin() + n_out, pcmf32.begin() + n_out + n_gap, 0.0f);
+      n_out += n_gap;
+    }
+    std::copy(pcmf32.begin() + speech[i].i0, pcmf32.begin() + speech[i].i1,
+              pcmf32.begin() + n_out);
+    n_out += speech[i].i1 - speech[i].i0;
+  }
+  pcmf32.resize(n_out);
+}
+
+// FIX 6: RUN WHISPER IN BACKGROUND THREAD?
+// MainActivity dispatches every call onto its worker pool, so we can block
+// here safely without freezing the UI thread, and several calls can be in
+// flight at once (bounded by the engine's state pool).
+// Returns the transcription, or an "Error: ..." message for Dart.
+static std::string transcribe_pcmf32(whisper_engine &engine,
+                                     std::vector<float> &pcmf32,
+                                     const audio_stats &stats) {
+  if (is_silence(stats)) {
+    // Return specific tag to let Dart know logic should proceed but no speech
+    // found Or just empty string? User said: "Silence detected – skipping"
+    // User's fix 2 says "cleanText.isEmpty ? I heard silence"
+    return "";
+  }
+
+  trim_to_speech(pcmf32);
+
+  std::string text;
+  int ret = whisper_engine_transcribe(engine, pcmf32.data(), pcmf32.size(),
+                                      text);
+  if (ret == WHISPER_ENGINE_ERR_LOAD) {
+    return "Error: Failed to initialize whisper context";
+  }
+  if (ret == WHISPER_ENGINE_ERR_BUSY) {
+    return "Error: Transcriber busy";
+  }
+  if (ret == WHISPER_ENGINE_ERR_RELEASED) {
+    return "Error: Model was released";
+  }
+  if (ret != WHISPER_ENGINE_OK) {
+    return "Error: Whisper failed to process";
+  }
+
+  return text;
+}
+
+static std::string transcribe_file(whisper_engine &engine, const char *audio) {
+  std::vector<float> pcmf32;
+  audio_stats stats;
+  if (const char *err = wav_read_pcmf32(audio, WHISPER_SAMPLE_RATE, pcmf32,
+                                        nullptr, &stats)) {
+    return err;
+  }
+
+  return transcribe_pcmf32(engine, pcmf32, stats);
+}
+
+// Transcribes 16-bit mono PCM handed over in memory; no file I/O at all.
+static std::string transcribe_pcm16(whisper_engine &engine,
+                                    const int16_t *samples, int n_samples,
+                                    int sample_rate) {
+  std::vector<float> pcmf32;
+  audio_stats stats;
+  if (const char *err = pcm16_read_pcmf32(samples, n_samples, sample_rate,
+                                          WHISPER_SAMPLE_RATE, pcmf32,
+                                          &stats)) {
+    return err;
+  }
+
+  return transcribe_pcmf32(engine, pcmf32, stats);
+}
+
+// Legacy one-shot entry point. The model is kept resident after the first
+// call, so only the first transcription pays for loading it.
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_speechmate_speechmate_MainActivity_transcribe(JNIEnv *env, jobject,
                                                        jstring modelPath,
@@ -13,110 +125,354 @@ Java_com_speechmate_speechmate_MainActivity_transcribe(JNIEnv *env, jobject,
   const char *model = env->GetStringUTFChars(modelPath, 0);
   const char *audio = env->GetStringUTFChars(audioPath, 0);
 
-  // FIX 5: Correct Whisper init
-  struct whisper_context_params cparams = whisper_context_default_params();
-  cparams.use_gpu = false;
-
-  struct whisper_context *ctx =
-      whisper_init_from_file_with_params(model, cparams);
+  int64_t handle = whisper_engine_lookup(model);
+  if (handle == 0) {
+    handle = whisper_engine_acquire(model);
+  }
+  env->ReleaseStringUTFChars(modelPath, model);
 
-  if (ctx == nullptr) {
-    env->ReleaseStringUTFChars(modelPath, model);
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
     env->ReleaseStringUTFChars(audioPath, audio);
     return env->NewStringUTF("Error: Failed to initialize whisper context");
   }
 
-  FILE *f = fopen(audio, "rb");
-  if (!f) {
-    whisper_free(ctx);
-    env->ReleaseStringUTFChars(modelPath, model);
-    env->ReleaseStringUTFChars(audioPath, audio);
-    return env->NewStringUTF("Error: Audio file not found");
+  std::string result = transcribe_file(*engine, audio);
+  env->ReleaseStringUTFChars(audioPath, audio);
+
+  return env->NewStringUTF(result.c_str());
+}
+
+// Loads (or shares) the model at modelPath and returns a handle for it.
+// maxConcurrent bounds how many transcriptions run in parallel on it.
+// Returns 0 if the model could not be loaded.
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_speechmate_speechmate_MainActivity_initModel(JNIEnv *env, jobject,
+                                                      jstring modelPath,
+                                                      jint maxConcurrent) {
+  const char *model = env->GetStringUTFChars(modelPath, 0);
+  int64_t handle = whisper_engine_acquire(model, maxConcurrent);
+  env->ReleaseStringUTFChars(modelPath, model);
+
+  return handle;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_speechmate_speechmate_MainActivity_transcribeWithModel(
+    JNIEnv *env, jobject, jlong handle, jstring audioPath) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return env->NewStringUTF("Error: Model not loaded");
   }
 
-  fseek(f, 0, SEEK_END);
-  long fsize = ftell(f);
-  fseek(f, 0, SEEK_SET);
+  const char *audio = env->GetStringUTFChars(audioPath, 0);
+  std::string result = transcribe_file(*engine, audio);
+  env->ReleaseStringUTFChars(audioPath, audio);
 
-  // Simple WAV header check can also check for 44 bytes typically
-  if (fsize < 44) {
-    fclose(f);
-    whisper_free(ctx);
-    env->ReleaseStringUTFChars(modelPath, model);
-    env->ReleaseStringUTFChars(audioPath, audio);
-    return env->NewStringUTF("Error: Invalid WAV file (too small)");
+  return env->NewStringUTF(result.c_str());
+}
+
+// PCM from a direct java.nio.ByteBuffer (native byte order, 16-bit mono).
+// The samples are read in place, without copying them into a Java array.
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_speechmate_speechmate_MainActivity_transcribePcmBuffer(
+    JNIEnv *env, jobject, jlong handle, jobject buffer, jint numSamples,
+    jint sampleRate) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return env->NewStringUTF("Error: Model not loaded");
   }
 
-  fseek(f, 44, SEEK_SET); // Skip WAV header
+  const void *data = env->GetDirectBufferAddress(buffer);
+  const jlong capacity = env->GetDirectBufferCapacity(buffer);
+  if (data == nullptr) {
+    return env->NewStringUTF("Error: PCM buffer is not direct");
+  }
+  if (numSamples < 0 || (jlong)numSamples * 2 > capacity) {
+    return env->NewStringUTF("Error: PCM buffer is too small");
+  }
 
-  int num_samples = (fsize - 44) / 2; // 16-bit mono -> 2 bytes per sample
-  std::vector<float> pcmf32(num_samples);
-  std::vector<int16_t> pcm16(num_samples);
+  std::string result = transcribe_pcm16(
+      *engine, static_cast<const int16_t *>(data), numSamples, sampleRate);
 
-  fread(pcm16.data(), sizeof(int16_t), num_samples, f);
-  fclose(f);
+  return env->NewStringUTF(result.c_str());
+}
 
-  // FIX 3: C++ PCM -> FLOAT CONVERSION
-  for (int i = 0; i < num_samples; i++) {
-    pcmf32[i] = static_cast<float>(pcm16[i]) / 32768.0f;
+// PCM from a ShortArray (16-bit mono). The array is pinned only while the
+// samples are converted to float, not for the whole transcription.
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_speechmate_speechmate_MainActivity_transcribePcmShorts(
+    JNIEnv *env, jobject, jlong handle, jshortArray samples, jint sampleRate) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return env->NewStringUTF("Error: Model not loaded");
   }
 
-  // FIX 4: Silence detection
-  float energy = 0.0f;
-  for (int i = 0; i < pcmf32.size(); i++) {
-    energy += fabs(pcmf32[i]);
+  const jsize n_samples = env->GetArrayLength(samples);
+
+  std::vector<float> pcmf32;
+  audio_stats stats;
+
+  void *data = env->GetPrimitiveArrayCritical(samples, nullptr);
+  if (data == nullptr) {
+    return env->NewStringUTF("Error: Could not access PCM samples");
   }
-  if (pcmf32.size() > 0) {
-    energy /= pcmf32.size();
+  const char *err = pcm16_read_pcmf32(static_cast<const int16_t *>(data),
+                                      n_samples, sampleRate,
+                                      WHISPER_SAMPLE_RATE, pcmf32, &stats);
+  env->ReleasePrimitiveArrayCritical(samples, data, JNI_ABORT);
+
+  if (err) {
+    return env->NewStringUTF(err);
   }
 
-  if (energy < 0.002f) {
-    whisper_free(ctx);
-    env->ReleaseStringUTFChars(modelPath, model);
-    env->ReleaseStringUTFChars(audioPath, audio);
-    // Return specific tag to let Dart know logic should proceed but no speech
-    // found Or just empty string? User said: "Silence detected – skipping"
-    // User's fix 2 says "cleanText.isEmpty ? I heard silence"
-    return env->NewStringUTF("");
+  std::string result = transcribe_pcmf32(*engine, pcmf32, stats);
+
+  return env->NewStringUTF(result.c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_speechmate_speechmate_MainActivity_releaseModel(JNIEnv *, jobject,
+                                                         jlong handle) {
+  whisper_engine_release(handle);
+}
+
+// 0 = full 30 s encoder context, -1 = sized to each utterance (default),
+// > 0 = fixed context.
+extern "C" JNIEXPORT void JNICALL
+Java_com_speechmate_speechmate_MainActivity_setAudioCtx(JNIEnv *, jobject,
+                                                        jlong handle,
+                                                        jint audioCtx) {
+  whisper_engine_set_audio_ctx(handle, audioCtx);
+}
+
+// Warms up a loaded model (see whisper_engine_warmup), meant to run while the
+// splash screen is showing. Returns the time it took in microseconds, 0 if it
+// was already warm, or -1 on failure.
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_speechmate_speechmate_MainActivity_warmupModel(JNIEnv *, jobject,
+                                                        jlong handle) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return -1;
   }
 
-  // Release JNI strings immediately
-  env->ReleaseStringUTFChars(modelPath, model);
-  env->ReleaseStringUTFChars(audioPath, audio);
+  {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    if (engine->warm && engine->ctx != nullptr) {
+      return 0;
+    }
+  }
+
+  if (whisper_engine_warmup(*engine) != WHISPER_ENGINE_OK) {
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(engine->mutex);
+  return engine->t_warmup_us;
+}
+
+// Load, warm-up and first-transcription timings in microseconds:
+// [t_load_us, t_warmup_us, t_first_us, first_was_warm, n_transcriptions].
+// Returns null if the handle is unknown.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_speechmate_speechmate_MainActivity_modelTimings(JNIEnv *env, jobject,
+                                                         jlong handle) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return nullptr;
+  }
+
+  jlong timings[5];
+  {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    timings[0] = engine->t_load_us;
+    timings[1] = engine->t_warmup_us;
+    timings[2] = engine->t_first_us;
+    timings[3] = engine->first_was_warm ? 1 : 0;
+    timings[4] = engine->n_transcriptions;
+  }
+
+  jlongArray result = env->NewLongArray(5);
+  if (result != nullptr) {
+    env->SetLongArrayRegion(result, 0, 5, timings);
+  }
+  return result;
+}
+
+// Called from onTrimMemory: frees idle models, keeping their handles valid.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_speechmate_speechmate_MainActivity_trimMemory(JNIEnv *, jobject) {
+  return whisper_engine_trim();
+}
+
+// Build flags and CPU topology, e.g. "... | PERF_CORES = 4/8 | ".
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_speechmate_speechmate_MainActivity_systemInfo(JNIEnv *env, jobject) {
+  return env->NewStringUTF(whisper_print_system_info());
+}
+
+// The CPUs the compute threads are kept on.
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_speechmate_speechmate_MainActivity_performanceCores(JNIEnv *env,
+                                                             jobject) {
+  std::vector<jint> cpus(whisper_cpu_performance_cores(nullptr, 0));
+  whisper_cpu_performance_cores(cpus.data(), (int)cpus.size());
+
+  jintArray result = env->NewIntArray((jsize)cpus.size());
+  if (result != nullptr) {
+    env->SetIntArrayRegion(result, 0, (jsize)cpus.size(), cpus.data());
+  }
+  return result;
+}
+
+// Streaming sessions. Segments are delivered on the session's worker thread
+// by calling MainActivity.onStreamSegment, which forwards them to Dart.
+
+// Attaches the calling native thread to the JVM on first use and detaches it
+// again when the thread exits.
+static JNIEnv *jni_thread_env(JavaVM *vm) {
+  struct thread_guard {
+    JavaVM *vm = nullptr;
+    ~thread_guard() {
+      if (vm) {
+        vm->DetachCurrentThread();
+      }
+    }
+  };
+  static thread_local thread_guard guard;
 
-  // FIX 7: Proper params for tiny.en
-  whisper_full_params params =
-      whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-  params.language = "en";
-  params.translate = false;
-  params.print_progress = false;
-  params.print_realtime = false;
-  params.print_special = false;
-  params.no_context = true;
-  params.single_segment = true;
-
-  // FIX 6: RUN WHISPER IN BACKGROUND THREAD?
-  // Since we are calling this whole function via `compute` (background isolate)
-  // in Dart, we can block here safely without freezing the UI thread. This
-  // satisfies the user's intent to "Prevent hangs".
-
-  int ret = whisper_full(ctx, params, pcmf32.data(), pcmf32.size());
-  if (ret != 0) {
-    whisper_free(ctx);
-    return env->NewStringUTF("Error: Whisper failed to process");
-  }
-
-  std::string text = "";
-  int n = whisper_full_n_segments(ctx);
-  for (int i = 0; i < n; i++) {
-    const char *segment = whisper_full_get_segment_text(ctx, i);
-    if (segment) {
-      text += segment;
+  JNIEnv *env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) ==
+      JNI_EDETACHED) {
+    if (vm->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+      return nullptr;
     }
+    guard.vm = vm;
   }
+  return env;
+}
+
+// Owns the global reference to the activity for as long as a session's
+// callback can run.
+struct jni_stream_listener {
+  JavaVM *vm = nullptr;
+  jobject target = nullptr;
+  jmethodID on_segment = nullptr;
+
+  ~jni_stream_listener() {
+    if (target == nullptr) {
+      return;
+    }
+    if (JNIEnv *env = jni_thread_env(vm)) {
+      env->DeleteGlobalRef(target);
+    }
+  }
+
+  void operator()(const whisper_stream_segment &segment) const {
+    JNIEnv *env = jni_thread_env(vm);
+    if (!env) {
+      return;
+    }
+
+    jstring text = env->NewStringUTF(segment.text.c_str());
+    env->CallVoidMethod(target, on_segment, (jlong)segment.stream,
+                        (jlong)segment.seq, text,
+                        (jboolean)(segment.is_final ? JNI_TRUE : JNI_FALSE));
+    if (env->ExceptionCheck()) {
+      env->ExceptionClear();
+    }
+    env->DeleteLocalRef(text);
+  }
+};
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_speechmate_speechmate_MainActivity_streamOpen(
+    JNIEnv *env, jobject thiz, jlong handle, jint sampleRate, jint stepMs,
+    jint lengthMs) {
+  auto listener = std::make_shared<jni_stream_listener>();
+  env->GetJavaVM(&listener->vm);
+  listener->on_segment =
+      env->GetMethodID(env->GetObjectClass(thiz), "onStreamSegment",
+                       "(JJLjava/lang/String;Z)V");
+  if (listener->on_segment == nullptr) {
+    env->ExceptionClear();
+    return 0;
+  }
+  listener->target = env->NewGlobalRef(thiz);
+
+  whisper_stream_params params;
+  params.sample_rate = sampleRate;
+  params.step_ms = stepMs;
+  params.length_ms = lengthMs;
+
+  return whisper_stream_open(
+      handle, params,
+      [listener](const whisper_stream_segment &segment) {
+        (*listener)(segment);
+      });
+}
 
-  whisper_free(ctx);
+// Returns the number of samples dropped so far, or -1 if the stream is gone.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_speechmate_speechmate_MainActivity_streamPush(JNIEnv *env, jobject,
+                                                       jlong stream,
+                                                       jshortArray samples) {
+  const jsize n_samples = env->GetArrayLength(samples);
 
+  std::vector<int16_t> pcm16(n_samples);
+  env->GetShortArrayRegion(samples, 0, n_samples, pcm16.data());
+
+  return whisper_stream_push_pcm16(stream, pcm16.data(), n_samples);
+}
+
+// Returns {finalized text, partial text}, or null if the stream is gone.
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_speechmate_speechmate_MainActivity_streamPoll(JNIEnv *env, jobject,
+                                                       jlong stream) {
+  std::string text_final;
+  std::string text_partial;
+  if (whisper_stream_poll(stream, text_final, text_partial) < 0) {
+    return nullptr;
+  }
+
+  jobjectArray result =
+      env->NewObjectArray(2, env->FindClass("java/lang/String"), nullptr);
+  env->SetObjectArrayElement(result, 0, env->NewStringUTF(text_final.c_str()));
+  env->SetObjectArrayElement(result, 1,
+                             env->NewStringUTF(text_partial.c_str()));
+
+  return result;
+}
+
+// Finishes the queued audio and returns the complete finalized text.
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_speechmate_speechmate_MainActivity_streamClose(JNIEnv *env, jobject,
+                                                        jlong stream) {
+  std::string text = whisper_stream_close(stream);
   return env->NewStringUTF(text.c_str());
 }
+
+// Dart FFI entry points (see lib/services/whisper_service.dart). They skip the
+// method channel entirely: Dart passes a pointer to PCM it already holds in
+// native memory, and calls this from a background isolate.
+//
+// Returns a malloc'd UTF-8 string (the transcription or an "Error: ..."
+// message) that must be released with speechmate_free_text.
+extern "C" JNIEXPORT char *speechmate_transcribe_pcm16(int64_t handle,
+                                                       const int16_t *samples,
+                                                       int32_t n_samples,
+                                                       int32_t sample_rate) {
+  std::string result;
+
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    result = "Error: Model not loaded";
+  } else {
+    result = transcribe_pcm16(*engine, samples, n_samples, sample_rate);
+  }
+
+  return strdup(result.c_str());
+}
+
+extern "C" JNIEXPORT void speechmate_free_text(char *text) { free(text); }
@@ -0,0 +1,380 @@
+#include "wav-reader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Frames decoded per block while streaming the data chunk.
+const int WAV_BLOCK_FRAMES = 4096;
+
+// Output rates are small (16 kHz), so any sane input rate reduces to a few
+// hundred phases (44.1 kHz -> 160/441). This only rejects odd rates that
+// share almost no factors with the output rate.
+const int RESAMPLER_MAX_PHASES = 2048;
+
+int gcd(int a, int b) {
+  while (b != 0) {
+    const int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+uint16_t read_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+uint32_t read_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decodes one sample (little endian) to [-1, 1).
+float decode_sample(const uint8_t *p, const wav_format &fmt) {
+  if (fmt.format == WAV_FORMAT_IEEE_FLOAT) {
+    if (fmt.bits_per_sample == 32) {
+      float v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return (float)v;
+  }
+
+  switch (fmt.bits_per_sample) {
+  case 8:
+    return ((int)p[0] - 128) / 128.0f;
+  case 16:
+    return (int16_t)read_u16(p) / 32768.0f;
+  case 24:
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+                     (uint32_t)p[2] << 24) /
+           2147483648.0f;
+  case 32:
+    return (int32_t)read_u32(p) / 2147483648.0f;
+  }
+  return 0.0f;
+}
+
+bool format_supported(const wav_format &fmt) {
+  if (fmt.n_channels == 0 || fmt.sample_rate == 0) {
+    return false;
+  }
+  if (fmt.block_align < fmt.n_channels * (fmt.bits_per_sample / 8)) {
+    return false;
+  }
+  if (fmt.format == WAV_FORMAT_PCM) {
+    return fmt.bits_per_sample == 8 || fmt.bits_per_sample == 16 ||
+           fmt.bits_per_sample == 24 || fmt.bits_per_sample == 32;
+  }
+  if (fmt.format == WAV_FORMAT_IEEE_FLOAT) {
+    return fmt.bits_per_sample == 32 || fmt.bits_per_sample == 64;
+  }
+  return false;
+}
+
+bool parse_fmt_chunk(const uint8_t *data, uint32_t size, wav_format &fmt) {
+  if (size < 16) {
+    return false;
+  }
+
+  fmt.format = read_u16(data + 0);
+  fmt.n_channels = read_u16(data + 2);
+  fmt.sample_rate = read_u32(data + 4);
+  fmt.block_align = read_u16(data + 12);
+  fmt.bits_per_sample = read_u16(data + 14);
+
+  if (fmt.format == WAV_FORMAT_EXTENSIBLE) {
+    // cbSize, wValidBitsPerSample, dwChannelMask, then the sub-format GUID
+    // whose first two bytes are the actual format code.
+    if (size < 40) {
+      return false;
+    }
+    fmt.format = read_u16(data + 24);
+  }
+
+  return true;
+}
+
+} // namespace
+
+bool pcm_resampler::init(int rate_in, int rate_out, int taps_per_phase) {
+  const int g = gcd(rate_in, rate_out);
+  up = rate_out / g;
+  down = rate_in / g;
+
+  if (up > RESAMPLER_MAX_PHASES) {
+    return false;
+  }
+
+  n_in = 0;
+  n_out = 0;
+
+  if (up == down) {
+    n_taps = 1;
+    coefs.assign(1, 1.0f);
+    history.clear();
+    return true;
+  }
+
+  // When decimating, the filter has to span more input samples to keep the
+  // same transition band relative to the (lower) output rate.
+  n_taps = taps_per_phase * (down > up ? (down + up - 1) / up : 1);
+
+  // Windowed-sinc low-pass at the lower of the two Nyquist frequencies, in
+  // cycles per sample of the virtual up-sampled signal.
+  const int n = up * n_taps;
+  const double fc = 0.9 * 0.5 / (up > down ? up : down);
+  const double center = 0.5 * (n - 1);
+
+  coefs.resize(n);
+  for (int i = 0; i < n; i++) {
+    const double t = i - center;
+    const double sinc =
+        t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+    const double window = 0.42 - 0.5 * cos(2.0 * M_PI * i / (n - 1)) +
+                          0.08 * cos(4.0 * M_PI * i / (n - 1));
+
+    // Tap j of phase p is prototype coefficient p + j*up. The gain of up
+    // makes up for the zeros a plain up-sampler would have inserted.
+    const int phase = i % up;
+    const int tap = i / up;
+    coefs[phase * n_taps + tap] = (float)(sinc * window * up);
+  }
+
+  history.assign(n_taps - 1, 0.0f);
+
+  return true;
+}
+
+void pcm_resampler::process(const float *samples, int n,
+                            std::vector<float> &out) {
+  if (up == down) {
+    out.insert(out.end(), samples, samples + n);
+    n_in += n;
+    n_out += n;
+    return;
+  }
+
+  // history[0] holds input sample n_in - (n_taps - 1)
+  const int64_t first = n_in - (n_taps - 1);
+
+  history.insert(history.end(), samples, samples + n);
+  n_in += n;
+
+  // Output k sits at k*down in the up-sampled domain; shifting by the filter
+  // delay lines output 0 up with input 0.
+  const int64_t delay = (int64_t)(up * n_taps - 1) / 2;
+
+  for (;;) {
+    const int64_t pos = n_out * down + delay;
+    const int64_t newest = pos / up;
+    if (newest >= n_in) {
+      break;
+    }
+
+    const float *h = coefs.data() + (pos % up) * n_taps;
+    const float *x = history.data() + (newest - first);
+
+    float sum = 0.0f;
+    for (int j = 0; j < n_taps; j++) {
+      sum += h[j] * x[-j];
+    }
+
+    out.push_back(sum);
+    n_out++;
+  }
+
+  history.erase(history.begin(), history.end() - (n_taps - 1));
+}
+
+void pcm_resampler::flush(std::vector<float> &out) {
+  if (up == down) {
+    return;
+  }
+
+  const int64_t n_expected = (n_in * up + down - 1) / down;
+
+  const std::vector<float> zeros(n_taps, 0.0f);
+  while (n_out < n_expected) {
+    process(zeros.data(), zeros.size(), out);
+  }
+
+  // The last block of zeros may overshoot.
+  out.resize(out.size() - (n_out - n_expected));
+  n_out = n_expected;
+}
+
+const char *wav_read_pcmf32(const char *path, int out_rate,
+                            std::vector<float> &pcmf32,
+                            wav_format *format_out,
+                            audio_stats *stats_out) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return "Error: Audio file not found";
+  }
+
+  fseek(f, 0, SEEK_END);
+  const long fsize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t header[12];
+  if (fsize < 12 || fread(header, 1, sizeof(header), f) != sizeof(header)) {
+    fclose(f);
+    return "Error: Invalid WAV file (too small)";
+  }
+  if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+    fclose(f);
+    return "Error: Not a RIFF/WAVE file";
+  }
+
+  // Walk the chunks until the data chunk; fmt must come before it.
+  wav_format fmt;
+  bool has_fmt = false;
+  long data_size = -1;
+
+  uint8_t chunk[8];
+  while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk)) {
+    const uint32_t size = read_u32(chunk + 4);
+    const long pos = ftell(f);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      std::vector<uint8_t> data(size);
+      if (fread(data.data(), 1, size, f) != size ||
+          !parse_fmt_chunk(data.data(), size, fmt)) {
+        fclose(f);
+        return "Error: Invalid WAV format chunk";
+      }
+      has_fmt = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      // Recorders that are killed mid-write leave 0 or 0xFFFFFFFF here.
+      data_size = size;
+      if (size == 0 || pos + (long)size > fsize || pos + (long)size < pos) {
+        data_size = fsize - pos;
+      }
+      break;
+    }
+
+    // Skip LIST, fact, cue and anything else; chunks are word aligned.
+    fseek(f, pos + size + (size & 1), SEEK_SET);
+  }
+
+  if (!has_fmt || data_size <= 0) {
+    fclose(f);
+    return "Error: Invalid WAV file (no audio data)";
+  }
+  if (!format_supported(fmt)) {
+    fclose(f);
+    return "Error: Unsupported WAV format";
+  }
+
+  pcm_resampler resampler;
+  if (!resampler.init(fmt.sample_rate, out_rate)) {
+    fclose(f);
+    return "Error: Unsupported sample rate";
+  }
+
+  if (format_out) {
+    *format_out = fmt;
+  }
+
+  const long n_frames = data_size / fmt.block_align;
+
+  if (stats_out) {
+    *stats_out = audio_stats();
+  }
+
+  pcmf32.clear();
+  pcmf32.reserve((int64_t)n_frames * resampler.up / resampler.down + 1);
+
+  const int bytes_per_sample = fmt.bits_per_sample / 8;
+  const float channel_scale = 1.0f / fmt.n_channels;
+
+  std::vector<uint8_t> raw((size_t)WAV_BLOCK_FRAMES * fmt.block_align);
+  std::vector<float> mono(WAV_BLOCK_FRAMES);
+
+  // 16-bit mono is what the recorder produces; it goes through the
+  // vectorized kernel, which also gathers the stats on the way.
+  const bool is_pcm16_mono = fmt.format == WAV_FORMAT_PCM &&
+                             fmt.bits_per_sample == 16 &&
+                             fmt.n_channels == 1 && fmt.block_align == 2;
+
+  long n_left = n_frames;
+  while (n_left > 0) {
+    const int n_want = n_left < WAV_BLOCK_FRAMES ? n_left : WAV_BLOCK_FRAMES;
+    const int n_read = fread(raw.data(), fmt.block_align, n_want, f);
+    if (n_read <= 0) {
+      break;
+    }
+
+    if (is_pcm16_mono) {
+      audio_pcm16_to_f32(reinterpret_cast<const int16_t *>(raw.data()),
+                         mono.data(), n_read, stats_out);
+    } else {
+      for (int i = 0; i < n_read; i++) {
+        const uint8_t *frame = raw.data() + (size_t)i * fmt.block_align;
+
+        float sum = 0.0f;
+        for (int c = 0; c < fmt.n_channels; c++) {
+          sum += decode_sample(frame + c * bytes_per_sample, fmt);
+        }
+        mono[i] = fmt.n_channels == 1 ? sum : sum * channel_scale;
+      }
+
+      if (stats_out) {
+        audio_f32_stats(mono.data(), n_read, *stats_out);
+      }
+    }
+
+    resampler.process(mono.data(), n_read, pcmf32);
+    n_left -= n_read;
+  }
+
+  fclose(f);
+
+  resampler.flush(pcmf32);
+
+  return nullptr;
+}
+
+const char *pcm16_read_pcmf32(const int16_t *samples, int n_samples,
+                              int rate_in, int out_rate,
+                              std::vector<float> &pcmf32,
+                              audio_stats *stats_out) {
+  if (samples == nullptr || n_samples <= 0) {
+    return "Error: No audio samples";
+  }
+
+  pcm_resampler resampler;
+  if (rate_in <= 0 || !resampler.init(rate_in, out_rate)) {
+    return "Error: Unsupported sample rate";
+  }
+
+  if (stats_out) {
+    *stats_out = audio_stats();
+  }
+
+  // Already at the output rate: convert straight into the result.
+  if (resampler.up == resampler.down) {
+    pcmf32.resize(n_samples);
+    audio_pcm16_to_f32(samples, pcmf32.data(), n_samples, stats_out);
+    return nullptr;
+  }
+
+  pcmf32.clear();
+  pcmf32.reserve((int64_t)n_samples * resampler.up / resampler.down + 1);
+
+  std::vector<float> mono(WAV_BLOCK_FRAMES);
+  for (int i0 = 0; i0 < n_samples; i0 += WAV_BLOCK_FRAMES) {
+    const int n = std::min(WAV_BLOCK_FRAMES, n_samples - i0);
+
+    audio_pcm16_to_f32(samples + i0, mono.data(), n, stats_out);
+    resampler.process(mono.data(), n, pcmf32);
+  }
+
+  resampler.flush(pcmf32);
+
+  return nullptr;
+}
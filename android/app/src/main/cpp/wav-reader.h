@@ -0,0 +1,72 @@
+#pragma once
+
+#include "whisper/examples/common-audio.h"
+
+#include <cstdint>
+#include <vector>
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IEEE_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+// Contents of the "fmt " chunk. For WAVE_FORMAT_EXTENSIBLE files, format is
+// the sub-format taken from the GUID (PCM or IEEE float).
+struct wav_format {
+  uint16_t format = 0;
+  uint16_t n_channels = 0;
+  uint32_t sample_rate = 0;
+  uint16_t block_align = 0;
+  uint16_t bits_per_sample = 0;
+};
+
+// Streaming polyphase resampler for a rational ratio rate_out/rate_in = L/M.
+//
+// The windowed-sinc prototype filter is split into L phases of n_taps
+// coefficients each, so every output sample costs n_taps multiply-adds no
+// matter how large L is. Input can be pushed in blocks of any size; only the
+// last n_taps - 1 input samples are kept between blocks.
+struct pcm_resampler {
+  int up = 1;   // L
+  int down = 1; // M
+  int n_taps = 0;
+
+  std::vector<float> coefs;   // [phase][tap], up * n_taps values
+  std::vector<float> history; // last n_taps - 1 inputs, then the new block
+
+  int64_t n_in = 0;  // inputs consumed so far
+  int64_t n_out = 0; // outputs produced so far
+
+  // Returns false if the ratio cannot be represented with a reasonable
+  // number of phases.
+  bool init(int rate_in, int rate_out, int taps_per_phase = 32);
+
+  // Appends the resampled output of n samples to out.
+  void process(const float *samples, int n, std::vector<float> &out);
+
+  // Pushes the filter delay worth of silence so the tail of the signal is
+  // emitted, then appends it to out.
+  void flush(std::vector<float> &out);
+};
+
+// Reads a RIFF/WAVE file and converts it to mono float PCM at out_rate.
+//
+// Walks the chunk list (fmt, data; LIST and unknown chunks are skipped),
+// accepts 8/16/24/32-bit integer and 32/64-bit float samples with any number
+// of channels, and streams the data chunk through the decoder, downmix and
+// resampler in fixed-size blocks straight into pcmf32. If stats_out is set,
+// the mean-abs energy, peak and DC offset of the mono signal are gathered in
+// the same pass.
+// Returns nullptr on success, or the error message to hand back to Dart.
+const char *wav_read_pcmf32(const char *path, int out_rate,
+                            std::vector<float> &pcmf32,
+                            wav_format *format_out = nullptr,
+                            audio_stats *stats_out = nullptr);
+
+// Converts n_samples of 16-bit mono PCM at rate_in to float PCM at out_rate,
+// gathering the same stats as wav_read_pcmf32. Used for audio handed over in
+// memory instead of through a file.
+// Returns nullptr on success, or the error message to hand back to Dart.
+const char *pcm16_read_pcmf32(const int16_t *samples, int n_samples,
+                              int rate_in, int out_rate,
+                              std::vector<float> &pcmf32,
+                              audio_stats *stats_out = nullptr);
@@ -0,0 +1,426 @@
+#include "whisper-engine.h"
+
+#include <algorithm>
+#include <map>
+
+namespace {
+
+struct engine_registry {
+  std::mutex mutex;
+
+  int64_t next_handle = 1;
+
+  std::map<int64_t, std::shared_ptr<whisper_engine>> by_handle;
+  std::map<std::string, int64_t> by_path;
+};
+
+engine_registry &registry() {
+  static engine_registry instance;
+  return instance;
+}
+
+// Must be called with engine.mutex held.
+bool engine_load_locked(whisper_engine &engine) {
+  if (engine.ctx != nullptr) {
+    return true;
+  }
+
+  const int64_t t_start_us = ggml_time_us();
+
+  struct whisper_context_params cparams = whisper_context_default_params();
+  cparams.use_gpu = false;
+  // re-scoring a recording against another expected word only re-runs the
+  // decoder
+  cparams.cross_cache_bytes = 32u << 20;
+
+  engine.ctx = whisper_init_from_file_with_params_no_state(
+      engine.model_path.c_str(), cparams);
+  if (engine.ctx == nullptr) {
+    return false;
+  }
+
+  engine.t_load_us = ggml_time_us() - t_start_us;
+  engine.n_loads++;
+
+  return true;
+}
+
+// Must be called with engine.mutex held.
+void engine_free_idle_states_locked(whisper_engine &engine) {
+  for (whisper_state *state : engine.states_idle) {
+    whisper_free_state(state);
+  }
+  engine.n_states -= engine.states_idle.size();
+  engine.states_idle.clear();
+}
+
+// Must be called with engine.mutex held and no state busy.
+void engine_unload_locked(whisper_engine &engine) {
+  engine_free_idle_states_locked(engine);
+
+  if (engine.ctx != nullptr) {
+    whisper_free(engine.ctx);
+    engine.ctx = nullptr;
+  }
+  engine.warm = false;
+}
+
+} // namespace
+
+whisper_engine::~whisper_engine() { engine_unload_locked(*this); }
+
+int64_t whisper_engine_acquire(const std::string &model_path,
+                               int n_states_max) {
+  engine_registry &reg = registry();
+
+  std::shared_ptr<whisper_engine> engine;
+  int64_t handle = 0;
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    auto it = reg.by_path.find(model_path);
+    if (it != reg.by_path.end()) {
+      handle = it->second;
+      engine = reg.by_handle[handle];
+    } else {
+      engine = std::make_shared<whisper_engine>();
+      engine->model_path = model_path;
+      engine->n_states_max = std::max(1, n_states_max);
+
+      handle = reg.next_handle++;
+      reg.by_handle[handle] = engine;
+      reg.by_path[model_path] = handle;
+    }
+
+    engine->n_refs++;
+  }
+
+  // Load outside of the registry lock so other models stay usable meanwhile.
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    ok = engine_load_locked(*engine);
+  }
+
+  if (!ok) {
+    whisper_engine_release(handle);
+    return 0;
+  }
+
+  return handle;
+}
+
+int64_t whisper_engine_lookup(const std::string &model_path) {
+  engine_registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+
+  auto it = reg.by_path.find(model_path);
+  return it != reg.by_path.end() ? it->second : 0;
+}
+
+void whisper_engine_release(int64_t handle) {
+  engine_registry &reg = registry();
+
+  std::shared_ptr<whisper_engine> engine;
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    auto it = reg.by_handle.find(handle);
+    if (it == reg.by_handle.end()) {
+      return;
+    }
+    if (--it->second->n_refs > 0) {
+      return;
+    }
+
+    engine = it->second;
+    reg.by_path.erase(engine->model_path);
+    reg.by_handle.erase(it);
+  }
+
+  // Turns away queued borrowers, then waits for in-flight transcriptions to
+  // finish before freeing.
+  std::unique_lock<std::mutex> lock(engine->mutex);
+  engine->released = true;
+  engine->cv.notify_all();
+  engine->cv.wait(lock, [&] { return engine->n_busy == 0; });
+  engine_unload_locked(*engine);
+}
+
+std::shared_ptr<whisper_engine> whisper_engine_get(int64_t handle) {
+  engine_registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+
+  auto it = reg.by_handle.find(handle);
+  return it != reg.by_handle.end() ? it->second : nullptr;
+}
+
+// Takes a state from the pool, creating one if the pool is not at capacity.
+// Waits for a state to be returned otherwise.
+int whisper_engine_borrow_state(whisper_engine &engine, whisper_state *&state,
+                                int &n_threads) {
+  std::unique_lock<std::mutex> lock(engine.mutex);
+
+  for (;;) {
+    if (engine.released) {
+      return WHISPER_ENGINE_ERR_RELEASED;
+    }
+
+    if (!engine_load_locked(engine)) {
+      return WHISPER_ENGINE_ERR_LOAD;
+    }
+
+    if (!engine.states_idle.empty()) {
+      state = engine.states_idle.back();
+      engine.states_idle.pop_back();
+      break;
+    }
+
+    if (engine.n_states < engine.n_states_max) {
+      state = whisper_init_state(engine.ctx);
+      if (state == nullptr) {
+        return WHISPER_ENGINE_ERR_LOAD;
+      }
+      engine.n_states++;
+      break;
+    }
+
+    if (engine.n_waiting >= engine.n_queue_max) {
+      return WHISPER_ENGINE_ERR_BUSY;
+    }
+
+    engine.n_waiting++;
+    engine.cv.wait(lock);
+    engine.n_waiting--;
+  }
+
+  engine.n_busy++;
+
+  // Split the performance cores between the transcriptions running right
+  // now; whisper keeps the threads off the efficiency cores.
+  const int n_cores =
+      std::min(4, std::max(1, whisper_cpu_performance_cores(nullptr, 0)));
+  n_threads = std::max(1, n_cores / engine.n_busy);
+
+  return WHISPER_ENGINE_OK;
+}
+
+void whisper_engine_return_state(whisper_engine &engine,
+                                 whisper_state *state) {
+  {
+    std::lock_guard<std::mutex> lock(engine.mutex);
+    engine.states_idle.push_back(state);
+    engine.n_busy--;
+  }
+  engine.cv.notify_all();
+}
+
+void whisper_engine_set_audio_ctx(int64_t handle, int audio_ctx) {
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(handle);
+  if (!engine) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(engine->mutex);
+  engine->audio_ctx = audio_ctx;
+}
+
+int whisper_engine_audio_ctx(whisper_engine &engine, int n_samples) {
+  int audio_ctx;
+  {
+    std::lock_guard<std::mutex> lock(engine.mutex);
+    audio_ctx = engine.audio_ctx;
+  }
+
+  if (audio_ctx == WHISPER_ENGINE_AUDIO_CTX_AUTO) {
+    return whisper_audio_ctx_for_samples(engine.ctx, n_samples);
+  }
+  return std::max(0, audio_ctx);
+}
+
+namespace {
+
+// Mean log probability of the text tokens of the result, or 0 if there are
+// none.
+float result_mean_logprob(whisper_context *ctx, whisper_state *state) {
+  const whisper_token token_eot = whisper_token_eot(ctx);
+
+  double sum = 0.0;
+  int n = 0;
+
+  const int n_segments = whisper_full_n_segments_from_state(state);
+  for (int i = 0; i < n_segments; i++) {
+    const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+    for (int j = 0; j < n_tokens; j++) {
+      const whisper_token_data data =
+          whisper_full_get_token_data_from_state(state, i, j);
+      if (data.id < token_eot) {
+        sum += data.plog;
+        n++;
+      }
+    }
+  }
+
+  return n > 0 ? sum / n : 0.0f;
+}
+
+} // namespace
+
+int whisper_engine_warmup(whisper_engine &engine) {
+  {
+    std::lock_guard<std::mutex> lock(engine.mutex);
+    if (engine.warm && engine.ctx != nullptr) {
+      return WHISPER_ENGINE_OK;
+    }
+  }
+
+  const int64_t t_start_us = ggml_time_us();
+
+  whisper_state *state = nullptr;
+  int n_threads = 1;
+
+  int ret = whisper_engine_borrow_state(engine, state, n_threads);
+  if (ret != WHISPER_ENGINE_OK) {
+    return ret;
+  }
+
+  whisper_context *ctx = engine.ctx;
+
+  // Same shape of call as a short utterance, but stop after the first token:
+  // that is enough to run every encoder and decoder layer once.
+  const std::vector<float> silence(WHISPER_SAMPLE_RATE *
+                                       WHISPER_ENGINE_WARMUP_MS / 1000,
+                                   0.0f);
+
+  whisper_full_params params =
+      whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+  params.n_threads = n_threads;
+  params.language = "en";
+  params.print_progress = false;
+  params.print_realtime = false;
+  params.print_special = false;
+  params.no_context = true;
+  params.single_segment = true;
+  params.max_tokens = 1;
+  params.temperature_inc = 0.0f;
+  params.audio_ctx = whisper_engine_audio_ctx(engine, silence.size());
+
+  if (whisper_full_with_state(ctx, state, params, silence.data(),
+                              silence.size()) != 0) {
+    ret = WHISPER_ENGINE_ERR_FULL;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(engine.mutex);
+    if (ret == WHISPER_ENGINE_OK) {
+      engine.warm = true;
+      engine.t_warmup_us = ggml_time_us() - t_start_us;
+    }
+  }
+
+  whisper_engine_return_state(engine, state);
+
+  return ret;
+}
+
+int whisper_engine_transcribe(whisper_engine &engine, const float *samples,
+                              int n_samples, std::string &text_out) {
+  const int64_t t_start_us = ggml_time_us();
+
+  whisper_state *state = nullptr;
+  int n_threads = 1;
+
+  int ret = whisper_engine_borrow_state(engine, state, n_threads);
+  if (ret != WHISPER_ENGINE_OK) {
+    return ret;
+  }
+
+  // The weights cannot be unloaded while a state is busy, so ctx is stable.
+  whisper_context *ctx = engine.ctx;
+
+  whisper_full_params params =
+      whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+  params.n_threads = n_threads;
+  params.language = "en";
+  params.translate = false;
+  params.print_progress = false;
+  params.print_realtime = false;
+  params.print_special = false;
+  params.no_context = true;
+  params.single_segment = true;
+  params.audio_ctx = whisper_engine_audio_ctx(engine, n_samples);
+
+  int status = whisper_full_with_state(ctx, state, params, samples, n_samples);
+
+  // Short-utterance mode: a reduced context trades a little robustness for a
+  // much cheaper encoder, so retry with the full one if that went wrong.
+  if (params.audio_ctx > 0 &&
+      (status != 0 || result_mean_logprob(ctx, state) <
+                          WHISPER_ENGINE_AUDIO_CTX_LOGPROB_THOLD)) {
+    {
+      std::lock_guard<std::mutex> lock(engine.mutex);
+      engine.n_audio_ctx_fallbacks++;
+    }
+
+    params.audio_ctx = 0;
+    status = whisper_full_with_state(ctx, state, params, samples, n_samples);
+  }
+
+  if (status != 0) {
+    ret = WHISPER_ENGINE_ERR_FULL;
+  } else {
+    text_out.clear();
+    const int n = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n; i++) {
+      const char *segment =
+          whisper_full_get_segment_text_from_state(state, i);
+      if (segment) {
+        text_out += segment;
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(engine.mutex);
+    if (engine.n_transcriptions++ == 0) {
+      engine.t_first_us = ggml_time_us() - t_start_us;
+      engine.first_was_warm = engine.warm;
+    }
+    // A real transcription warms the engine just as well.
+    engine.warm = engine.warm || ret == WHISPER_ENGINE_OK;
+  }
+
+  whisper_engine_return_state(engine, state);
+
+  return ret;
+}
+
+int whisper_engine_trim() {
+  std::vector<std::shared_ptr<whisper_engine>> engines;
+  {
+    engine_registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    for (auto &it : reg.by_handle) {
+      engines.push_back(it.second);
+    }
+  }
+
+  int n_unloaded = 0;
+  for (auto &engine : engines) {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+
+    engine_free_idle_states_locked(*engine);
+
+    if (engine->n_busy > 0 || engine->n_waiting > 0 ||
+        engine->ctx == nullptr) {
+      continue;
+    }
+    engine_unload_locked(*engine);
+    n_unloaded++;
+  }
+
+  return n_unloaded;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "whisper/whisper.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define WHISPER_ENGINE_DEFAULT_MAX_STATES 2
+#define WHISPER_ENGINE_DEFAULT_MAX_QUEUE 8
+
+// whisper_engine::audio_ctx values
+#define WHISPER_ENGINE_AUDIO_CTX_FULL 0  // always encode the full 30 s context
+#define WHISPER_ENGINE_AUDIO_CTX_AUTO -1 // short-utterance mode, see below
+
+// Short-utterance results whose mean token log probability is below this are
+// decoded again with the full context.
+#define WHISPER_ENGINE_AUDIO_CTX_LOGPROB_THOLD -1.0f
+
+// Length of the silent buffer decoded by whisper_engine_warmup. whisper_full
+// skips anything under 1 s.
+#define WHISPER_ENGINE_WARMUP_MS 2000
+
+enum whisper_engine_status {
+  WHISPER_ENGINE_OK = 0,
+  WHISPER_ENGINE_ERR_LOAD = -1, // model (or a state for it) could not be loaded
+  WHISPER_ENGINE_ERR_FULL = -2, // whisper_full_with_state failed
+  WHISPER_ENGINE_ERR_BUSY = -3, // all states busy and the wait queue is full
+  WHISPER_ENGINE_ERR_RELEASED = -4, // the last handle was released
+};
+
+// A whisper model that stays resident across transcriptions.
+//
+// Engines are shared per model path: every caller that asks for the same file
+// gets the same weights, and the context is only freed when the last handle is
+// released or when the app is asked to give memory back.
+//
+// The context is loaded without a default state. Each transcription borrows a
+// whisper_state from a small pool, so up to n_states_max requests run
+// concurrently on one copy of the weights. Further requests wait in a bounded
+// queue; once that is full they are rejected with WHISPER_ENGINE_ERR_BUSY.
+struct whisper_engine {
+  // Backstop for a model left loaded when the last reference drops.
+  ~whisper_engine();
+
+  std::string model_path;
+
+  int n_states_max = WHISPER_ENGINE_DEFAULT_MAX_STATES;
+  int n_queue_max = WHISPER_ENGINE_DEFAULT_MAX_QUEUE;
+
+  // Guards everything below.
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  // nullptr while unloaded (memory pressure); reloaded on the next request.
+  whisper_context *ctx = nullptr;
+
+  std::vector<whisper_state *> states_idle;
+  int n_states = 0;  // allocated states, idle + busy
+  int n_busy = 0;    // states currently inside whisper_full_with_state
+  int n_waiting = 0; // requests queued for a state
+
+  int n_refs = 0;
+
+  // Set once the last handle is released; queued and later borrowers fail
+  // with WHISPER_ENGINE_ERR_RELEASED instead of reloading the model.
+  bool released = false;
+
+  // Encoder context: WHISPER_ENGINE_AUDIO_CTX_AUTO sizes it to the audio
+  // (whisper_audio_ctx_for_samples) and falls back to the full context when
+  // that fails or decodes poorly; any other value is passed as is.
+  int audio_ctx = WHISPER_ENGINE_AUDIO_CTX_AUTO;
+  int n_audio_ctx_fallbacks = 0;
+
+  int64_t t_load_us = 0;
+  int n_loads = 0;
+
+  // Set by whisper_engine_warmup, cleared when the model is unloaded.
+  bool warm = false;
+  int64_t t_warmup_us = 0;
+
+  // Latency of the first whisper_engine_transcribe call, and whether the
+  // engine had been warmed up by then.
+  int64_t t_first_us = 0;
+  bool first_was_warm = false;
+  int n_transcriptions = 0;
+};
+
+// Returns a handle to the engine for model_path, loading the model if this is
+// the first reference. n_states_max only applies when the engine is created.
+// Returns 0 if the model could not be loaded.
+int64_t whisper_engine_acquire(
+    const std::string &model_path,
+    int n_states_max = WHISPER_ENGINE_DEFAULT_MAX_STATES);
+
+// Returns the handle of an already registered engine, or 0.
+int64_t whisper_engine_lookup(const std::string &model_path);
+
+// Drops one reference; the model is freed when the last one goes away.
+void whisper_engine_release(int64_t handle);
+
+// Resolves a handle. The returned pointer keeps the engine alive even if the
+// handle is released concurrently.
+std::shared_ptr<whisper_engine> whisper_engine_get(int64_t handle);
+
+// Sets whisper_engine::audio_ctx for the engine behind handle.
+void whisper_engine_set_audio_ctx(int64_t handle, int audio_ctx);
+
+// The audio_ctx to use for n_samples of audio. engine.ctx must be loaded.
+int whisper_engine_audio_ctx(whisper_engine &engine, int n_samples);
+
+// Runs whisper_full_with_state on 16 kHz mono float PCM and concatenates the
+// segment text into text_out. Blocks while all states are busy and the queue
+// has room. Reloads the model if it was trimmed.
+// Returns a whisper_engine_status.
+int whisper_engine_transcribe(whisper_engine &engine, const float *samples,
+                              int n_samples, std::string &text_out);
+
+// Runs a short dummy encode/decode on silence so that the first real
+// transcription does not pay for graph allocation, page faults on the mapped
+// weights and cold caches. Creates a pooled state if there is none yet.
+// Does nothing if the engine is already warm.
+// Returns a whisper_engine_status.
+int whisper_engine_warmup(whisper_engine &engine);
+
+// Borrows a state for callers that need their own whisper_full_params (e.g.
+// streaming). Same pooling and queueing rules as whisper_engine_transcribe;
+// n_threads is set to this caller's share of the cores. On success the state
+// must be handed back with whisper_engine_return_state, and engine.ctx stays
+// valid until then.
+// Returns a whisper_engine_status.
+int whisper_engine_borrow_state(whisper_engine &engine, whisper_state *&state,
+                                int &n_threads);
+
+void whisper_engine_return_state(whisper_engine &engine, whisper_state *state);
+
+// Frees idle states of all engines, and the weights of engines with no
+// transcription in flight, without invalidating their handles.
+// Returns the number of models that were unloaded.
+int whisper_engine_trim();
@@ -0,0 +1,456 @@
+#include "whisper-stream.h"
+
+#include "wav-reader.h"
+#include "whisper-engine.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <thread>
+
+namespace {
+
+// Same threshold as the one-shot silence check in native-lib.cpp.
+const float STREAM_SILENCE_MEAN_ABS = 0.002f;
+
+// Fixed-capacity FIFO of float samples. When full, the oldest samples are
+// overwritten: for live captions recent audio matters more than old audio.
+struct pcm_ring {
+  std::vector<float> buf;
+  size_t head = 0; // index of the oldest sample
+  size_t size = 0;
+
+  void init(size_t capacity) {
+    buf.assign(capacity, 0.0f);
+    head = 0;
+    size = 0;
+  }
+
+  // Returns the number of old samples overwritten.
+  size_t push(const float *samples, size_t n) {
+    const size_t cap = buf.size();
+
+    size_t n_dropped = 0;
+    if (n > cap) {
+      n_dropped += n - cap;
+      samples += n - cap;
+      n = cap;
+    }
+    if (size + n > cap) {
+      const size_t n_over = size + n - cap;
+      head = (head + n_over) % cap;
+      size -= n_over;
+      n_dropped += n_over;
+    }
+
+    const size_t tail = (head + size) % cap;
+    const size_t n0 = std::min(n, cap - tail);
+    memcpy(buf.data() + tail, samples, n0 * sizeof(float));
+    memcpy(buf.data(), samples + n0, (n - n0) * sizeof(float));
+    size += n;
+
+    return n_dropped;
+  }
+
+  void pop(size_t n, std::vector<float> &out) {
+    const size_t cap = buf.size();
+
+    n = std::min(n, size);
+    out.resize(n);
+
+    const size_t n0 = std::min(n, cap - head);
+    memcpy(out.data(), buf.data() + head, n0 * sizeof(float));
+    memcpy(out.data() + n0, buf.data(), (n - n0) * sizeof(float));
+
+    head = (head + n) % cap;
+    size -= n;
+  }
+};
+
+} // namespace
+
+struct whisper_stream {
+  int64_t id = 0;
+  int64_t engine_handle = 0;
+  std::shared_ptr<whisper_engine> engine;
+
+  whisper_stream_params params;
+  whisper_stream_callback on_segment;
+
+  int n_samples_step = 0;
+  int n_samples_len = 0;
+  int n_samples_keep = 0;
+  int n_new_line = 1;
+
+  // Guards everything below.
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  pcm_resampler resampler;
+  std::vector<float> pcm_push;
+
+  pcm_ring ring;
+  int64_t n_dropped = 0;
+  bool closing = false;
+
+  int64_t seq = 0;
+  std::string text_final;
+  std::string text_partial;
+
+  std::thread worker;
+
+  // Worker thread only. Mel frames of the audio so far, so each step only
+  // runs the FFT on its new samples. Created with the first transcribed
+  // window, which starts at stream position mel_t0.
+  whisper_mel_stream *mel = nullptr;
+  int64_t mel_t0 = 0;
+};
+
+namespace {
+
+struct stream_registry {
+  std::mutex mutex;
+
+  int64_t next_id = 1;
+
+  std::map<int64_t, std::shared_ptr<whisper_stream>> by_id;
+};
+
+stream_registry &registry() {
+  static stream_registry instance;
+  return instance;
+}
+
+std::shared_ptr<whisper_stream> stream_get(int64_t id) {
+  stream_registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+
+  auto it = reg.by_id.find(id);
+  return it != reg.by_id.end() ? it->second : nullptr;
+}
+
+// Runs one window, the pcmf32 audio ending at stream position n_samples_end,
+// through whisper. tokens_out receives the tokens of the result so a
+// finalized window can prompt the next one.
+bool stream_transcribe(whisper_stream &s, const std::vector<float> &pcmf32,
+                       int64_t n_samples_end,
+                       const std::vector<whisper_token> &prompt_tokens,
+                       std::string &text_out,
+                       std::vector<whisper_token> &tokens_out) {
+  text_out.clear();
+  tokens_out.clear();
+
+  const int64_t t1 = n_samples_end;
+  const int64_t t0 = t1 - (int64_t)pcmf32.size();
+
+  audio_stats stats;
+  audio_f32_stats(pcmf32.data(), pcmf32.size(), stats);
+  if (stats.mean_abs() < STREAM_SILENCE_MEAN_ABS) {
+    if (s.mel != nullptr) {
+      whisper_mel_stream_discard(s.mel, t0 - s.mel_t0);
+    }
+    return true;
+  }
+
+  whisper_state *state = nullptr;
+  int n_threads = 1;
+  if (whisper_engine_borrow_state(*s.engine, state, n_threads) !=
+      WHISPER_ENGINE_OK) {
+    return false;
+  }
+
+  whisper_full_params wparams =
+      whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+  wparams.n_threads = n_threads;
+  wparams.language = "en";
+  wparams.translate = false;
+  wparams.print_progress = false;
+  wparams.print_realtime = false;
+  wparams.print_special = false;
+  wparams.print_timestamps = false;
+  wparams.no_timestamps = true;
+  wparams.single_segment = true;
+  wparams.max_tokens = s.params.max_tokens;
+  wparams.no_context = true;
+  wparams.prompt_tokens =
+      prompt_tokens.empty() ? nullptr : prompt_tokens.data();
+  wparams.prompt_n_tokens = prompt_tokens.size();
+  wparams.audio_ctx = whisper_engine_audio_ctx(*s.engine, pcmf32.size());
+
+  if (s.mel == nullptr) {
+    s.mel = whisper_mel_stream_init(s.engine->ctx);
+    s.mel_t0 = t0;
+    whisper_mel_stream_push(s.mel, pcmf32.data(), pcmf32.size());
+  }
+
+  int ret = whisper_mel_stream_set_with_state(s.engine->ctx, state, s.mel,
+                                              t0 - s.mel_t0, t1 - s.mel_t0);
+  if (ret == 0) {
+    ret = whisper_full_with_state(s.engine->ctx, state, wparams, nullptr, 0);
+  }
+  if (ret == 0) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; i++) {
+      text_out += whisper_full_get_segment_text_from_state(state, i);
+
+      const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+      for (int j = 0; j < n_tokens; j++) {
+        tokens_out.push_back(
+            whisper_full_get_token_id_from_state(state, i, j));
+      }
+    }
+  }
+
+  whisper_engine_return_state(*s.engine, state);
+
+  // Later windows never start before this one.
+  whisper_mel_stream_discard(s.mel, t0 - s.mel_t0);
+
+  return ret == 0;
+}
+
+void stream_emit(whisper_stream &s, const std::string &text, bool is_final,
+                 int64_t n_samples_end, int n_samples_window) {
+  whisper_stream_segment segment;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (is_final) {
+      s.text_final += text;
+      s.text_partial.clear();
+    } else {
+      s.text_partial = text;
+    }
+
+    segment.stream = s.id;
+    segment.seq = ++s.seq;
+  }
+
+  segment.is_final = is_final;
+  segment.text = text;
+  segment.t1_ms = n_samples_end * 1000 / WHISPER_SAMPLE_RATE;
+  segment.t0_ms =
+      std::max<int64_t>(0, segment.t1_ms - (int64_t)n_samples_window * 1000 /
+                                               WHISPER_SAMPLE_RATE);
+
+  if (s.on_segment) {
+    s.on_segment(segment);
+  }
+}
+
+// The loop of examples/stream (non-VAD mode), fed from the ring buffer.
+void stream_worker(whisper_stream *s) {
+  std::vector<float> pcmf32_new;
+  std::vector<float> pcmf32_old;
+  std::vector<float> pcmf32;
+
+  std::vector<whisper_token> prompt_tokens;
+  std::vector<whisper_token> tokens;
+  std::string text;
+
+  int64_t n_samples_total = 0;
+  int n_iter = 0;
+  bool pending = false; // last emitted window was partial
+
+  for (;;) {
+    bool last = false;
+    {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      s->cv.wait(lock, [&] {
+        return s->closing || (int)s->ring.size >= s->n_samples_step;
+      });
+
+      if (s->ring.size == 0) {
+        break; // closing, nothing left
+      }
+
+      // When the worker falls behind, catch up with one longer step rather
+      // than queueing more and more windows.
+      s->ring.pop(s->n_samples_len, pcmf32_new);
+      last = s->closing && s->ring.size == 0;
+    }
+
+    const int n_samples_new = pcmf32_new.size();
+    n_samples_total += n_samples_new;
+
+    if (s->mel != nullptr) {
+      whisper_mel_stream_push(s->mel, pcmf32_new.data(), n_samples_new);
+    }
+
+    // take up to length_ms audio from previous iteration
+    const int n_samples_take =
+        std::min((int)pcmf32_old.size(),
+                 std::max(0, s->n_samples_keep + s->n_samples_len -
+                                 n_samples_new));
+
+    pcmf32.resize(n_samples_new + n_samples_take);
+    std::copy(pcmf32_old.end() - n_samples_take, pcmf32_old.end(),
+              pcmf32.begin());
+    std::copy(pcmf32_new.begin(), pcmf32_new.end(),
+              pcmf32.begin() + n_samples_take);
+
+    pcmf32_old = pcmf32;
+
+    if (!stream_transcribe(*s, pcmf32, n_samples_total, prompt_tokens, text,
+                           tokens)) {
+      // Keep the audio in pcmf32_old; the next window covers it again.
+      continue;
+    }
+
+    ++n_iter;
+
+    const bool is_final = last || (n_iter % s->n_new_line) == 0;
+    stream_emit(*s, text, is_final, n_samples_total, pcmf32.size());
+    pending = !is_final;
+
+    if (is_final) {
+      // keep part of the audio for next iteration to try to mitigate word
+      // boundary issues
+      const int n_keep = std::min((int)pcmf32.size(), s->n_samples_keep);
+      pcmf32_old.assign(pcmf32.end() - n_keep, pcmf32.end());
+
+      // Add tokens of the last full length segment as the prompt
+      if (!s->params.no_context) {
+        prompt_tokens = tokens;
+      }
+    }
+  }
+
+  // Closed right after a step boundary: the last partial window is complete.
+  if (pending) {
+    stream_emit(*s, text, true, n_samples_total, pcmf32.size());
+  }
+
+  whisper_mel_stream_free(s->mel);
+  s->mel = nullptr;
+}
+
+} // namespace
+
+int64_t whisper_stream_open(int64_t engine_handle,
+                            const whisper_stream_params &params,
+                            whisper_stream_callback on_segment) {
+  if (params.step_ms <= 0 || params.sample_rate <= 0) {
+    return 0;
+  }
+
+  std::shared_ptr<whisper_engine> engine = whisper_engine_get(engine_handle);
+  if (!engine) {
+    return 0;
+  }
+
+  auto s = std::make_shared<whisper_stream>();
+
+  s->params = params;
+  s->params.keep_ms = std::min(params.keep_ms, params.step_ms);
+  s->params.length_ms = std::max(params.length_ms, params.step_ms);
+  s->params.capacity_ms = std::max(params.capacity_ms, 2 * s->params.length_ms);
+
+  s->n_samples_step = (int64_t)s->params.step_ms * WHISPER_SAMPLE_RATE / 1000;
+  s->n_samples_len = (int64_t)s->params.length_ms * WHISPER_SAMPLE_RATE / 1000;
+  s->n_samples_keep = (int64_t)s->params.keep_ms * WHISPER_SAMPLE_RATE / 1000;
+  s->n_new_line =
+      std::max(1, s->params.length_ms / s->params.step_ms - 1);
+
+  if (!s->resampler.init(params.sample_rate, WHISPER_SAMPLE_RATE)) {
+    return 0;
+  }
+  s->ring.init((int64_t)s->params.capacity_ms * WHISPER_SAMPLE_RATE / 1000);
+
+  s->on_segment = std::move(on_segment);
+
+  // Hold a reference so the model is not released under the session.
+  s->engine_handle = whisper_engine_acquire(engine->model_path);
+  s->engine = whisper_engine_get(s->engine_handle);
+  if (!s->engine) {
+    return 0;
+  }
+
+  {
+    stream_registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    s->id = reg.next_id++;
+    reg.by_id[s->id] = s;
+  }
+
+  s->worker = std::thread(stream_worker, s.get());
+
+  return s->id;
+}
+
+int whisper_stream_push_pcm16(int64_t stream, const int16_t *samples,
+                              int n_samples) {
+  std::shared_ptr<whisper_stream> s = stream_get(stream);
+  if (!s) {
+    return -1;
+  }
+
+  size_t n_dropped = 0;
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->closing) {
+      return -1;
+    }
+
+    std::vector<float> mono(n_samples);
+    audio_pcm16_to_f32(samples, mono.data(), n_samples, nullptr);
+
+    s->pcm_push.clear();
+    s->resampler.process(mono.data(), n_samples, s->pcm_push);
+
+    n_dropped = s->ring.push(s->pcm_push.data(), s->pcm_push.size());
+    s->n_dropped += n_dropped;
+  }
+  s->cv.notify_one();
+
+  return (int)std::min<size_t>(n_dropped, INT_MAX);
+}
+
+int64_t whisper_stream_poll(int64_t stream, std::string &text_final,
+                            std::string &text_partial) {
+  std::shared_ptr<whisper_stream> s = stream_get(stream);
+  if (!s) {
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(s->mutex);
+  text_final = s->text_final;
+  text_partial = s->text_partial;
+
+  return s->seq;
+}
+
+std::string whisper_stream_close(int64_t stream) {
+  std::shared_ptr<whisper_stream> s;
+  {
+    stream_registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    auto it = reg.by_id.find(stream);
+    if (it == reg.by_id.end()) {
+      return "";
+    }
+    s = it->second;
+    reg.by_id.erase(it);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->closing = true;
+
+    s->pcm_push.clear();
+    s->resampler.flush(s->pcm_push);
+    s->n_dropped += s->ring.push(s->pcm_push.data(), s->pcm_push.size());
+  }
+  s->cv.notify_one();
+
+  s->worker.join();
+
+  whisper_engine_release(s->engine_handle);
+
+  std::lock_guard<std::mutex> lock(s->mutex);
+  return s->text_final;
+}
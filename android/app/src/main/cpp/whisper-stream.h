@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Sliding-window streaming on top of a resident whisper_engine, following the
+// loop in whisper/examples/stream: every step_ms of new audio the last
+// length_ms window is transcribed again and reported as a partial segment.
+// Every (length_ms / step_ms - 1) steps the window is finalized, keep_ms of it
+// is carried over to soften word boundaries, and its tokens become the prompt
+// for the next window.
+struct whisper_stream_params {
+  int sample_rate = 16000; // rate of the PCM passed to push_pcm16
+  int step_ms = 500;
+  int length_ms = 5000;
+  int keep_ms = 200;
+  int capacity_ms = 30000; // ring buffer; the oldest audio is dropped beyond
+  int max_tokens = 32;
+  bool no_context = false; // do not prompt a window with the previous one
+};
+
+struct whisper_stream_segment {
+  int64_t stream = 0;
+  int64_t seq = 0;    // increases with every segment of this stream
+  bool is_final = false;
+  std::string text;   // text of the current window
+  int64_t t0_ms = 0;  // window start, relative to the first pushed sample
+  int64_t t1_ms = 0;  // window end
+};
+
+// Called on the stream's worker thread, without any stream lock held.
+typedef std::function<void(const whisper_stream_segment &)>
+    whisper_stream_callback;
+
+// Starts a session on the engine behind engine_handle, which it keeps a
+// reference to until closed. on_segment may be empty when the caller polls.
+// Returns 0 if the engine handle is unknown or the parameters are invalid.
+int64_t whisper_stream_open(int64_t engine_handle,
+                            const whisper_stream_params &params,
+                            whisper_stream_callback on_segment);
+
+// Queues 16-bit mono PCM at params.sample_rate for the worker thread.
+// Returns the number of samples this push dropped because the worker fell more
+// than capacity_ms behind, or -1 if the stream is unknown or closed.
+int whisper_stream_push_pcm16(int64_t stream, const int16_t *samples,
+                              int n_samples);
+
+// Latest state of the session: the finalized text so far and the text of the
+// window still in progress. Returns the seq of the newest segment (0 if none
+// yet), or -1 if the stream is unknown.
+int64_t whisper_stream_poll(int64_t stream, std::string &text_final,
+                            std::string &text_partial);
+
+// Transcribes the audio still queued, finalizes the last window, stops the
+// worker thread and frees the session.
+// Returns the complete finalized text.
+std::string whisper_stream_close(int64_t stream);
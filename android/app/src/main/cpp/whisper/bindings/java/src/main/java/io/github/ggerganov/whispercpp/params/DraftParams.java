@@ -0,0 +1,20 @@
+package io.github.ggerganov.whispercpp.params;
+
+import com.sun.jna.Pointer;
+import com.sun.jna.Structure;
+
+import java.util.Arrays;
+import java.util.List;
+
+public class DraftParams extends Structure {
+    /** Context of the draft model, null disables speculative decoding. */
+    public Pointer ctx;
+
+    /** Number of tokens proposed by the draft model per step. */
+    public int n_draft;
+
+    @Override
+    protected List<String> getFieldOrder() {
+        return Arrays.asList("ctx", "n_draft");
+    }
+}
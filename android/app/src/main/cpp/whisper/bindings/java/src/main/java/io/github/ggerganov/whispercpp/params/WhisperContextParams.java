@@ -1,6 +1,7 @@
 package io.github.ggerganov.whispercpp.params;
 
 import com.sun.jna.*;
+import io.github.ggerganov.whispercpp.ggml.GgmlType;
 
 import java.util.Arrays;
 import java.util.List;
@@ -24,8 +25,38 @@ public class WhisperContextParams extends Structure {
         use_gpu = enable ? CBool.TRUE : CBool.FALSE;
     }
 
+    /** Memory-map the model file and use the weights in place (default = true) */
+    public CBool use_mmap;
+
+    /** Memory-map the model file and use the weights in place (default = true) */
+    public void useMmap(boolean enable) {
+        use_mmap = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
+    /** Keep the compute threads on the performance cores of big.LITTLE CPUs (default = true) */
+    public CBool use_perf_cores;
+
+    /** Keep the compute threads on the performance cores of big.LITTLE CPUs (default = true) */
+    public void usePerfCores(boolean enable) {
+        use_perf_cores = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
+    /** Storage type of the attention KV caches: F16, Q8_0 or Q4_0 (default = GGML_TYPE_F16) */
+    public int kv_type;
+
+    /** Storage type of the attention KV caches: F16, Q8_0 or Q4_0 (default = GGML_TYPE_F16) */
+    public void kvType(GgmlType type) {
+        kv_type = type.ordinal();
+    }
+
+    /** Upper bound on the cells of the self-attention KV cache (default = 0, meaning 3 * n_text_ctx) */
+    public int kv_self_max;
+
+    /** Bound in bytes on the cache of encoder results shared by the states of the context (default = 0, disabled) */
+    public long cross_cache_bytes;
+
     @Override
     protected List<String> getFieldOrder() {
-        return Arrays.asList("use_gpu");
+        return Arrays.asList("use_gpu", "use_mmap", "use_perf_cores", "kv_type", "kv_self_max", "cross_cache_bytes");
     }
 }
@@ -313,6 +313,20 @@ public class WhisperFullParams extends Structure {
     public long i_start_rule;
     public float grammar_penalty;
 
+    /**
+     * Speculative decoding, used for greedy sampling at temperature 0.
+     * The draft model must share the vocabulary and the mel bins of the model.
+     */
+    public DraftParams draft;
+
+    public void setDraft(Pointer ctx, int nDraft) {
+        if (draft == null) {
+            draft = new DraftParams();
+        }
+        draft.ctx = ctx;
+        draft.n_draft = nDraft;
+    }
+
     @Override
     protected List<String> getFieldOrder() {
         return Arrays.asList("strategy", "n_threads", "n_max_text_ctx", "offset_ms", "duration_ms", "translate",
@@ -326,6 +340,7 @@ public class WhisperFullParams extends Structure {
                 "progress_callback", "progress_callback_user_data",
                 "encoder_begin_callback", "encoder_begin_callback_user_data",
                 "logits_filter_callback", "logits_filter_callback_user_data",
-                "grammar_rules", "n_grammar_rules", "i_start_rule", "grammar_penalty");
+                "grammar_rules", "n_grammar_rules", "i_start_rule", "grammar_penalty",
+                "draft");
     }
 }
@@ -1,14 +1,17 @@
 #include "whisper.h"
+#include "common-audio.h"
 
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <thread>
+#include <vector>
 
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t what = 0; // what to benchmark: 0 - whisper ecoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t what = 0; // what to benchmark: 0 - whisper ecoder, 1 - memcpy, 2 - ggml_mul_mat, 3 - audio kernels, 4 - audio_ctx, 5 - mel, 6 - tokenizer
 
     std::string model = "models/ggml-base.en.bin";
 
@@ -52,13 +55,17 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper\n",                                 "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - audio kernels\n",                           "");
+    fprintf(stderr, "                           %-7s  4 - encoder time vs audio length (audio_ctx)\n", "");
+    fprintf(stderr, "                           %-7s  5 - log mel spectrogram\n",                    "");
+    fprintf(stderr, "                           %-7s  6 - prompt tokenizer\n",                       "");
     fprintf(stderr, "\n");
 }
 
 int whisper_bench_full(const whisper_params & params) {
     // whisper init
 
-    struct whisper_context_params cparams;
+    struct whisper_context_params cparams = whisper_context_default_params();
     cparams.use_gpu = params.use_gpu;
 
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
@@ -150,6 +157,229 @@ int whisper_bench_full(const whisper_params & params) {
     return 0;
 }
 
+// PCM16 -> float conversion plus mean-abs/peak/DC, as done on every
+// transcription: the fused kernel vs a scalar convert loop and energy loop
+int whisper_bench_audio() {
+    const size_t n = 30*WHISPER_SAMPLE_RATE;
+    const int n_iter = 50;
+
+    std::vector<int16_t> pcm16(n);
+    std::vector<float>   pcmf32(n);
+
+    for (size_t i = 0; i < n; i++) {
+        pcm16[i] = (int16_t) (8000.0f*sinf(2.0f*M_PI*440.0f*i/WHISPER_SAMPLE_RATE) + (i*7919 % 201) - 100);
+    }
+
+    double sum_scalar = 0.0;
+    double sum_fused  = 0.0;
+
+    int64_t t_scalar_us = 0;
+    int64_t t_fused_us  = 0;
+
+    for (int it = 0; it < n_iter; it++) {
+        {
+            const int64_t t0 = ggml_time_us();
+
+            for (size_t i = 0; i < n; i++) {
+                pcmf32[i] = pcm16[i]/32768.0f;
+            }
+
+            float sum_abs = 0.0f;
+            float sum     = 0.0f;
+            float peak    = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum_abs += fabsf(pcmf32[i]);
+                sum     += pcmf32[i];
+                peak     = fmaxf(peak, fabsf(pcmf32[i]));
+            }
+
+            t_scalar_us += ggml_time_us() - t0;
+            sum_scalar  += sum_abs + sum + peak;
+        }
+
+        {
+            const int64_t t0 = ggml_time_us();
+
+            audio_stats stats;
+            audio_pcm16_to_f32(pcm16.data(), pcmf32.data(), n, &stats);
+
+            t_fused_us += ggml_time_us() - t0;
+            sum_fused  += stats.sum_abs + stats.sum + stats.peak;
+        }
+    }
+
+    const double gb = (double) n*n_iter*(sizeof(int16_t) + sizeof(float))/1e9;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: %zu samples (30 s), %d iterations, kernels = %s\n", __func__, n, n_iter, audio_kernels_name());
+    fprintf(stderr, "%s: scalar: %8.3f ms/iter, %6.2f GB/s\n", __func__, 1e-3*t_scalar_us/n_iter, gb/(1e-6*t_scalar_us));
+    fprintf(stderr, "%s: fused:  %8.3f ms/iter, %6.2f GB/s, speedup %.2fx\n", __func__, 1e-3*t_fused_us/n_iter, gb/(1e-6*t_fused_us), (double) t_scalar_us/t_fused_us);
+    fprintf(stderr, "%s: checksum: scalar %.3f, fused %.3f\n", __func__, sum_scalar, sum_fused);
+
+    return 0;
+}
+
+// Encoder cost of short utterances: full 30 s context vs the reduced context
+// from whisper_audio_ctx_for_samples. Decoding is capped at one token so the
+// timings are dominated by mel + encoder.
+int whisper_bench_audio_ctx(const whisper_params & params) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    const int lengths_s[] = { 2, 3, 5, 10, 20, 30 };
+    const int n_iter = 3;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: n_threads = %d, n_iter = %d\n", __func__, params.n_threads, n_iter);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "| audio | audio_ctx | full ctx [ms] | reduced [ms] | speedup |\n");
+    fprintf(stderr, "| ----: | --------: | -----------: | -----------: | ------: |\n");
+
+    for (int len_s : lengths_s) {
+        const int n_samples = len_s*WHISPER_SAMPLE_RATE;
+
+        std::vector<float> pcmf32(n_samples);
+        for (int i = 0; i < n_samples; i++) {
+            pcmf32[i] = 0.1f*sinf(2.0f*M_PI*220.0f*i/WHISPER_SAMPLE_RATE);
+        }
+
+        const int audio_ctx = whisper_audio_ctx_for_samples(ctx, n_samples);
+
+        double t_ms[2] = { 0.0, 0.0 };
+        for (int mode = 0; mode < 2; mode++) {
+            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+            wparams.n_threads       = params.n_threads;
+            wparams.print_progress  = false;
+            wparams.print_realtime  = false;
+            wparams.single_segment  = true;
+            wparams.no_timestamps   = true;
+            wparams.max_tokens      = 1;
+            wparams.temperature_inc = 0.0f;
+            wparams.audio_ctx       = mode == 0 ? 0 : audio_ctx;
+
+            // warm-up
+            whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size());
+
+            const int64_t t0 = ggml_time_us();
+            for (int it = 0; it < n_iter; it++) {
+                if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+                    fprintf(stderr, "error: failed to process audio\n");
+                    whisper_free(ctx);
+                    return 4;
+                }
+            }
+            t_ms[mode] = 1e-3*(ggml_time_us() - t0)/n_iter;
+        }
+
+        fprintf(stderr, "| %3d s | %9d | %12.1f | %12.1f | %6.2fx |\n",
+                len_s, audio_ctx > 0 ? audio_ctx : whisper_n_audio_ctx(ctx), t_ms[0], t_ms[1], t_ms[0]/t_ms[1]);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
+// Mel extraction (framing, FFT, filterbank) for short and long audio
+int whisper_bench_mel(const whisper_params & params) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    const int lengths_s[] = { 2, 5, 10, 30 };
+    const int n_iter = 10;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: n_threads = %d, n_iter = %d\n", __func__, params.n_threads, n_iter);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "| audio | mel [ms] |\n");
+    fprintf(stderr, "| ----: | -------: |\n");
+
+    for (int len_s : lengths_s) {
+        const int n_samples = len_s*WHISPER_SAMPLE_RATE;
+
+        std::vector<float> pcmf32(n_samples);
+        for (int i = 0; i < n_samples; i++) {
+            pcmf32[i] = 0.1f*sinf(2.0f*M_PI*220.0f*i/WHISPER_SAMPLE_RATE);
+        }
+
+        const int64_t t0 = ggml_time_us();
+        for (int it = 0; it < n_iter; it++) {
+            if (whisper_pcm_to_mel(ctx, pcmf32.data(), n_samples, params.n_threads) != 0) {
+                fprintf(stderr, "error: failed to compute mel spectrogram\n");
+                whisper_free(ctx);
+                return 4;
+            }
+        }
+
+        fprintf(stderr, "| %3d s | %8.2f |\n", len_s, 1e-3*(ggml_time_us() - t0)/n_iter);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
+// Tokenization of prompts of increasing length, as done for initial_prompt by every whisper_full call
+int whisper_bench_tokenize(const whisper_params & params) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    const char * sample =
+        "Hello, I'm calling about the appointment on Tuesday at 10:30. We'll need 2 rooms, "
+        "and the doctor's notes from 2023 - don't forget them!  Thanks.\n";
+
+    const int lengths[] = { 64, 256, 1024, 4096 };
+    const int n_iter = 100;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: n_iter = %d\n", __func__, n_iter);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "| prompt [bytes] | tokens | tokenize [us] |\n");
+    fprintf(stderr, "| -------------: | -----: | ------------: |\n");
+
+    for (int len : lengths) {
+        std::string prompt;
+        while ((int) prompt.size() < len) {
+            prompt += sample;
+        }
+        prompt.resize(len);
+
+        std::vector<whisper_token> tokens(len + 1);
+
+        int n_tokens = 0;
+
+        const int64_t t0 = ggml_time_us();
+        for (int it = 0; it < n_iter; it++) {
+            n_tokens = whisper_tokenize(ctx, prompt.c_str(), tokens.data(), (int) tokens.size());
+        }
+
+        fprintf(stderr, "| %14d | %6d | %13.1f |\n", len, n_tokens, (double) (ggml_time_us() - t0)/n_iter);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -163,6 +393,10 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_full(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_audio();                        break;
+        case 4: ret = whisper_bench_audio_ctx(params);              break;
+        case 5: ret = whisper_bench_mel(params);                    break;
+        case 6: ret = whisper_bench_tokenize(params);               break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
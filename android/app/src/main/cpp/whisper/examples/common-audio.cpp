@@ -0,0 +1,515 @@
+#define _USE_MATH_DEFINES // for M_PI
+
+#include "common-audio.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The vector loops accumulate in float lanes; the partial sums are folded into
+// the double accumulators of audio_stats every AUDIO_CHUNK samples so long
+// recordings do not lose precision.
+#define AUDIO_CHUNK 4096
+
+namespace {
+
+struct chunk_acc {
+    float sum_abs = 0.0f;
+    float sum     = 0.0f;
+    float peak    = 0.0f;
+};
+
+void acc_scalar(chunk_acc & acc, float x) {
+    const float a = fabsf(x);
+    acc.sum_abs += a;
+    acc.sum     += x;
+    acc.peak     = a > acc.peak ? a : acc.peak;
+}
+
+#if defined(__ARM_NEON)
+
+#define AUDIO_KERNELS_NAME "NEON"
+#define AUDIO_STEP 8
+
+float neon_hsum(float32x4_t v) {
+#if defined(__aarch64__)
+    return vaddvq_f32(v);
+#else
+    const float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+
+float neon_hmax(float32x4_t v) {
+#if defined(__aarch64__)
+    return vmaxvq_f32(v);
+#else
+    const float32x2_t m = vmax_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpmax_f32(m, m), 0);
+#endif
+}
+
+// n must be a multiple of AUDIO_STEP
+void pcm16_to_f32_vec(const int16_t * src, float * dst, size_t n, chunk_acc * acc) {
+    const float32x4_t scale = vdupq_n_f32(1.0f/32768.0f);
+
+    float32x4_t sum_abs = vdupq_n_f32(0.0f);
+    float32x4_t sum     = vdupq_n_f32(0.0f);
+    float32x4_t peak    = vdupq_n_f32(0.0f);
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const int16x8_t x = vld1q_s16(src + i);
+
+        const float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16 (x))), scale);
+        const float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale);
+
+        vst1q_f32(dst + i,     lo);
+        vst1q_f32(dst + i + 4, hi);
+
+        if (acc) {
+            const float32x4_t alo = vabsq_f32(lo);
+            const float32x4_t ahi = vabsq_f32(hi);
+
+            sum_abs = vaddq_f32(sum_abs, vaddq_f32(alo, ahi));
+            sum     = vaddq_f32(sum,     vaddq_f32(lo,  hi));
+            peak    = vmaxq_f32(peak,    vmaxq_f32(alo, ahi));
+        }
+    }
+
+    if (acc) {
+        acc->sum_abs += neon_hsum(sum_abs);
+        acc->sum     += neon_hsum(sum);
+        acc->peak     = fmaxf(acc->peak, neon_hmax(peak));
+    }
+}
+
+void f32_stats_vec(const float * src, size_t n, chunk_acc & acc) {
+    float32x4_t sum_abs = vdupq_n_f32(0.0f);
+    float32x4_t sum     = vdupq_n_f32(0.0f);
+    float32x4_t peak    = vdupq_n_f32(0.0f);
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const float32x4_t lo = vld1q_f32(src + i);
+        const float32x4_t hi = vld1q_f32(src + i + 4);
+
+        const float32x4_t alo = vabsq_f32(lo);
+        const float32x4_t ahi = vabsq_f32(hi);
+
+        sum_abs = vaddq_f32(sum_abs, vaddq_f32(alo, ahi));
+        sum     = vaddq_f32(sum,     vaddq_f32(lo,  hi));
+        peak    = vmaxq_f32(peak,    vmaxq_f32(alo, ahi));
+    }
+
+    acc.sum_abs += neon_hsum(sum_abs);
+    acc.sum     += neon_hsum(sum);
+    acc.peak     = fmaxf(acc.peak, neon_hmax(peak));
+}
+
+#elif defined(__AVX2__)
+
+#define AUDIO_KERNELS_NAME "AVX2"
+#define AUDIO_STEP 8
+
+float avx_hsum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+float avx_hmax(__m256 v) {
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+void pcm16_to_f32_vec(const int16_t * src, float * dst, size_t n, chunk_acc * acc) {
+    const __m256 scale    = _mm256_set1_ps(1.0f/32768.0f);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    __m256 sum_abs = _mm256_setzero_ps();
+    __m256 sum     = _mm256_setzero_ps();
+    __m256 peak    = _mm256_setzero_ps();
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+        const __m256  f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x)), scale);
+
+        _mm256_storeu_ps(dst + i, f);
+
+        if (acc) {
+            const __m256 a = _mm256_and_ps(f, abs_mask);
+
+            sum_abs = _mm256_add_ps(sum_abs, a);
+            sum     = _mm256_add_ps(sum,     f);
+            peak    = _mm256_max_ps(peak,    a);
+        }
+    }
+
+    if (acc) {
+        acc->sum_abs += avx_hsum(sum_abs);
+        acc->sum     += avx_hsum(sum);
+        acc->peak     = fmaxf(acc->peak, avx_hmax(peak));
+    }
+}
+
+void f32_stats_vec(const float * src, size_t n, chunk_acc & acc) {
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    __m256 sum_abs = _mm256_setzero_ps();
+    __m256 sum     = _mm256_setzero_ps();
+    __m256 peak    = _mm256_setzero_ps();
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const __m256 f = _mm256_loadu_ps(src + i);
+        const __m256 a = _mm256_and_ps(f, abs_mask);
+
+        sum_abs = _mm256_add_ps(sum_abs, a);
+        sum     = _mm256_add_ps(sum,     f);
+        peak    = _mm256_max_ps(peak,    a);
+    }
+
+    acc.sum_abs += avx_hsum(sum_abs);
+    acc.sum     += avx_hsum(sum);
+    acc.peak     = fmaxf(acc.peak, avx_hmax(peak));
+}
+
+#elif defined(__SSE2__)
+
+#define AUDIO_KERNELS_NAME "SSE2"
+#define AUDIO_STEP 8
+
+float sse_hsum(__m128 s) {
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+float sse_hmax(__m128 m) {
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+void pcm16_to_f32_vec(const int16_t * src, float * dst, size_t n, chunk_acc * acc) {
+    const __m128 scale    = _mm_set1_ps(1.0f/32768.0f);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    __m128 sum_abs = _mm_setzero_ps();
+    __m128 sum     = _mm_setzero_ps();
+    __m128 peak    = _mm_setzero_ps();
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+
+        // sign-extend by placing each sample in the upper half of a 32-bit lane
+        const __m128i xlo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i xhi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+        const __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(xlo), scale);
+        const __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(xhi), scale);
+
+        _mm_storeu_ps(dst + i,     lo);
+        _mm_storeu_ps(dst + i + 4, hi);
+
+        if (acc) {
+            const __m128 alo = _mm_and_ps(lo, abs_mask);
+            const __m128 ahi = _mm_and_ps(hi, abs_mask);
+
+            sum_abs = _mm_add_ps(sum_abs, _mm_add_ps(alo, ahi));
+            sum     = _mm_add_ps(sum,     _mm_add_ps(lo,  hi));
+            peak    = _mm_max_ps(peak,    _mm_max_ps(alo, ahi));
+        }
+    }
+
+    if (acc) {
+        acc->sum_abs += sse_hsum(sum_abs);
+        acc->sum     += sse_hsum(sum);
+        acc->peak     = fmaxf(acc->peak, sse_hmax(peak));
+    }
+}
+
+void f32_stats_vec(const float * src, size_t n, chunk_acc & acc) {
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    __m128 sum_abs = _mm_setzero_ps();
+    __m128 sum     = _mm_setzero_ps();
+    __m128 peak    = _mm_setzero_ps();
+
+    for (size_t i = 0; i < n; i += AUDIO_STEP) {
+        const __m128 lo = _mm_loadu_ps(src + i);
+        const __m128 hi = _mm_loadu_ps(src + i + 4);
+
+        const __m128 alo = _mm_and_ps(lo, abs_mask);
+        const __m128 ahi = _mm_and_ps(hi, abs_mask);
+
+        sum_abs = _mm_add_ps(sum_abs, _mm_add_ps(alo, ahi));
+        sum     = _mm_add_ps(sum,     _mm_add_ps(lo,  hi));
+        peak    = _mm_max_ps(peak,    _mm_max_ps(alo, ahi));
+    }
+
+    acc.sum_abs += sse_hsum(sum_abs);
+    acc.sum     += sse_hsum(sum);
+    acc.peak     = fmaxf(acc.peak, sse_hmax(peak));
+}
+
+#else
+
+#define AUDIO_KERNELS_NAME "scalar"
+#define AUDIO_STEP 1
+
+void pcm16_to_f32_vec(const int16_t * src, float * dst, size_t n, chunk_acc * acc) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i]/32768.0f;
+        if (acc) {
+            acc_scalar(*acc, dst[i]);
+        }
+    }
+}
+
+void f32_stats_vec(const float * src, size_t n, chunk_acc & acc) {
+    for (size_t i = 0; i < n; i++) {
+        acc_scalar(acc, src[i]);
+    }
+}
+
+#endif
+
+void fold(audio_stats & stats, const chunk_acc & acc, size_t n) {
+    stats.sum_abs += acc.sum_abs;
+    stats.sum     += acc.sum;
+    stats.peak     = acc.peak > stats.peak ? acc.peak : stats.peak;
+    stats.n       += n;
+}
+
+} // namespace
+
+void audio_pcm16_to_f32(const int16_t * src, float * dst, size_t n, audio_stats * stats) {
+    for (size_t i0 = 0; i0 < n; i0 += AUDIO_CHUNK) {
+        const size_t nc = n - i0 < AUDIO_CHUNK ? n - i0 : AUDIO_CHUNK;
+        const size_t nv = nc - nc % AUDIO_STEP;
+
+        chunk_acc acc;
+        pcm16_to_f32_vec(src + i0, dst + i0, nv, stats ? &acc : nullptr);
+
+        for (size_t i = i0 + nv; i < i0 + nc; i++) {
+            dst[i] = src[i]/32768.0f;
+            acc_scalar(acc, dst[i]);
+        }
+
+        if (stats) {
+            fold(*stats, acc, nc);
+        }
+    }
+}
+
+void audio_f32_stats(const float * src, size_t n, audio_stats & stats) {
+    for (size_t i0 = 0; i0 < n; i0 += AUDIO_CHUNK) {
+        const size_t nc = n - i0 < AUDIO_CHUNK ? n - i0 : AUDIO_CHUNK;
+        const size_t nv = nc - nc % AUDIO_STEP;
+
+        chunk_acc acc;
+        f32_stats_vec(src + i0, nv, acc);
+
+        for (size_t i = i0 + nv; i < i0 + nc; i++) {
+            acc_scalar(acc, src[i]);
+        }
+
+        fold(stats, acc, nc);
+    }
+}
+
+namespace {
+
+// In-place iterative radix-2 FFT, n a power of two
+void vad_fft(std::vector<float> & re, std::vector<float> & im) {
+    const size_t n = re.size();
+
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        const float ang = -2.0f*M_PI/len;
+        const float wr = cosf(ang);
+        const float wi = sinf(ang);
+        for (size_t i = 0; i < n; i += len) {
+            float cr = 1.0f;
+            float ci = 0.0f;
+            for (size_t k = 0; k < len/2; k++) {
+                const size_t a = i + k;
+                const size_t b = a + len/2;
+
+                const float tr = re[b]*cr - im[b]*ci;
+                const float ti = re[b]*ci + im[b]*cr;
+
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+
+                const float nr = cr*wr - ci*wi;
+                ci = cr*wi + ci*wr;
+                cr = nr;
+            }
+        }
+    }
+}
+
+struct vad_frame {
+    float energy_db;
+    float zcr;
+    float flatness;
+};
+
+} // namespace
+
+std::vector<audio_interval> audio_vad_detect(const float * samples, size_t n, int sample_rate, const audio_vad_params & params) {
+    std::vector<audio_interval> result;
+
+    const int n_frame = std::max(1, params.frame_ms*sample_rate/1000);
+    const size_t n_frames = n/n_frame;
+    if (n_frames == 0) {
+        return result;
+    }
+
+    int n_fft = 1;
+    while (n_fft < n_frame) {
+        n_fft <<= 1;
+    }
+
+    // flatness is measured over the band that carries voicing
+    const int bin0 = std::max(1,         (int) (150.0f *n_fft/sample_rate));
+    const int bin1 = std::min(n_fft/2,   (int) (4000.0f*n_fft/sample_rate));
+
+    std::vector<float> window(n_frame);
+    for (int i = 0; i < n_frame; i++) {
+        window[i] = 0.5f - 0.5f*cosf(2.0f*M_PI*i/n_frame);
+    }
+
+    std::vector<float> re(n_fft);
+    std::vector<float> im(n_fft);
+
+    std::vector<vad_frame> frames(n_frames);
+
+    for (size_t f = 0; f < n_frames; f++) {
+        const float * x = samples + f*n_frame;
+
+        float sum2 = 0.0f;
+        int   n_zc = 0;
+        for (int i = 0; i < n_frame; i++) {
+            sum2 += x[i]*x[i];
+            if (i > 0 && (x[i - 1] < 0.0f) != (x[i] < 0.0f)) {
+                n_zc++;
+            }
+        }
+
+        std::fill(re.begin(), re.end(), 0.0f);
+        std::fill(im.begin(), im.end(), 0.0f);
+        for (int i = 0; i < n_frame; i++) {
+            re[i] = x[i]*window[i];
+        }
+        vad_fft(re, im);
+
+        double sum_log = 0.0;
+        double sum_pow = 0.0;
+        for (int k = bin0; k < bin1; k++) {
+            const double p = re[k]*re[k] + im[k]*im[k] + 1e-12;
+            sum_log += log(p);
+            sum_pow += p;
+        }
+        const int n_bins = std::max(1, bin1 - bin0);
+
+        frames[f].energy_db = 10.0f*log10f(sum2/n_frame + 1e-12f);
+        frames[f].zcr       = (float) n_zc/n_frame;
+        frames[f].flatness  = (float) (exp(sum_log/n_bins)/(sum_pow/n_bins));
+    }
+
+    // noise floor: a quiet-but-not-silent reference, capped so that recordings
+    // with hardly any pauses do not treat their own speech as noise
+    float noise_db;
+    {
+        std::vector<float> energies(n_frames);
+        for (size_t f = 0; f < n_frames; f++) {
+            energies[f] = frames[f].energy_db;
+        }
+        std::nth_element(energies.begin(), energies.begin() + n_frames/10, energies.end());
+        noise_db = std::min(energies[n_frames/10], params.noise_max);
+    }
+
+    const float energy_db_min = std::max(params.energy_min, noise_db + params.energy_thold);
+
+    const int n_start    = std::max(1, params.start_ms   /params.frame_ms);
+    const int n_hangover = std::max(1, params.hangover_ms/params.frame_ms);
+
+    // hysteresis + hangover
+    std::vector<audio_interval> raw;
+    {
+        bool   in_speech = false;
+        int    n_run     = 0; // consecutive speech (outside) or silence (inside) frames
+        size_t f_begin   = 0;
+
+        for (size_t f = 0; f < n_frames; f++) {
+            const vad_frame & fr = frames[f];
+
+            const bool is_speech =
+                fr.energy_db > energy_db_min &&
+                (fr.zcr < params.zcr_thold || fr.flatness < params.flatness_thold);
+
+            if (!in_speech) {
+                n_run = is_speech ? n_run + 1 : 0;
+                if (n_run >= n_start) {
+                    in_speech = true;
+                    f_begin   = f + 1 - n_run;
+                    n_run     = 0;
+                }
+            } else {
+                n_run = is_speech ? 0 : n_run + 1;
+                if (n_run >= n_hangover) {
+                    in_speech = false;
+                    raw.push_back({ (int64_t) f_begin*n_frame, (int64_t) (f + 1 - n_run)*n_frame });
+                    n_run = 0;
+                }
+            }
+        }
+
+        if (in_speech) {
+            raw.push_back({ (int64_t) f_begin*n_frame, (int64_t) n });
+        }
+    }
+
+    // padding + merging
+    const int64_t n_pad   = (int64_t) params.pad_ms  *sample_rate/1000;
+    const int64_t n_merge = (int64_t) params.merge_ms*sample_rate/1000;
+
+    for (const audio_interval & iv : raw) {
+        const int64_t i0 = std::max<int64_t>(0,           iv.i0 - n_pad);
+        const int64_t i1 = std::min<int64_t>((int64_t) n, iv.i1 + n_pad);
+
+        if (!result.empty() && i0 - result.back().i1 < n_merge) {
+            result.back().i1 = std::max(result.back().i1, i1);
+        } else {
+            result.push_back({ i0, i1 });
+        }
+    }
+
+    return result;
+}
+
+const char * audio_kernels_name() {
+    return AUDIO_KERNELS_NAME;
+}
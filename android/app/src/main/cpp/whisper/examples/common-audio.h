@@ -0,0 +1,72 @@
+#pragma once
+
+// Vectorized PCM conversion and energy kernels (NEON, AVX2, SSE2, scalar)
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Running statistics of a float PCM signal, accumulated across calls
+struct audio_stats {
+    double  sum_abs = 0.0; // sum of |x|
+    double  sum     = 0.0; // sum of x
+    float   peak    = 0.0f; // max |x|
+    int64_t n       = 0;
+
+    float mean_abs() const { return n > 0 ? (float) (sum_abs/n) : 0.0f; }
+    float dc()       const { return n > 0 ? (float) (sum/n)     : 0.0f; }
+};
+
+// Converts n signed 16-bit samples to float in [-1, 1).
+// If stats is not null, the output is also accumulated into it in the same pass.
+void audio_pcm16_to_f32(
+        const int16_t * src,
+        float * dst,
+        size_t n,
+        audio_stats * stats);
+
+// Accumulates the statistics of n float samples into stats
+void audio_f32_stats(
+        const float * src,
+        size_t n,
+        audio_stats & stats);
+
+//
+// Voice activity detection
+//
+
+struct audio_vad_params {
+    int   frame_ms       = 30;
+
+    float energy_thold   = 9.0f;   // dB above the noise floor for a frame to count as loud
+    float energy_min     = -50.0f; // dBFS; quieter frames are never speech
+    float noise_max      = -35.0f; // dBFS; cap on the estimated noise floor
+    float zcr_thold      = 0.25f;  // zero crossings per sample; above looks like noise
+    float flatness_thold = 0.45f;  // spectral flatness (0 tonal .. 1 white); above looks like noise
+
+    int   start_ms       = 90;     // speech needed to open a segment
+    int   hangover_ms    = 300;    // silence needed to close it again
+    int   pad_ms         = 200;    // kept around every segment
+    int   merge_ms       = 400;    // segments closer than this are joined
+};
+
+// Sample range [i0, i1)
+struct audio_interval {
+    int64_t i0;
+    int64_t i1;
+};
+
+// Frame-based VAD: a frame is speech if it is loud relative to the noise floor
+// (the 10th percentile of frame energies) and voiced-looking, i.e. it has a low
+// zero-crossing rate or a peaky (non-flat) spectrum. Hysteresis (start_ms) and
+// hangover (hangover_ms) turn the frame decisions into speech intervals, which
+// are then padded and merged.
+// Returns the speech intervals in increasing order; empty if there is no speech.
+std::vector<audio_interval> audio_vad_detect(
+        const float * samples,
+        size_t n,
+        int sample_rate,
+        const audio_vad_params & params);
+
+// Name of the kernel set selected at compile time, e.g. "NEON"
+const char * audio_kernels_name();
@@ -1,6 +1,7 @@
 #define _USE_MATH_DEFINES // for M_PI
 
 #include "common.h"
+#include "common-audio.h"
 
 // third-party utilities
 // use your favorite implementations
@@ -674,9 +675,7 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
     // convert to mono, float
     pcmf32.resize(n);
     if (wav.channels == 1) {
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[i])/32768.0f;
-        }
+        audio_pcm16_to_f32(pcm16.data(), pcmf32.data(), n, nullptr);
     } else {
         for (uint64_t i = 0; i < n; i++) {
             pcmf32[i] = float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
@@ -724,19 +723,17 @@ bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float
         high_pass_filter(pcmf32, freq_thold, sample_rate);
     }
 
-    float energy_all  = 0.0f;
-    float energy_last = 0.0f;
+    // one pass: the head and the last window are accumulated separately
+    audio_stats stats_head;
+    audio_stats stats_last;
 
-    for (int i = 0; i < n_samples; i++) {
-        energy_all += fabsf(pcmf32[i]);
+    const int n_samples_head = n_samples - n_samples_last;
 
-        if (i >= n_samples - n_samples_last) {
-            energy_last += fabsf(pcmf32[i]);
-        }
-    }
+    audio_f32_stats(pcmf32.data(),                  n_samples_head, stats_head);
+    audio_f32_stats(pcmf32.data() + n_samples_head, n_samples_last, stats_last);
 
-    energy_all  /= n_samples;
-    energy_last /= n_samples_last;
+    const float energy_all  = (float) ((stats_head.sum_abs + stats_last.sum_abs)/n_samples);
+    const float energy_last = stats_last.mean_abs();
 
     if (verbose) {
         fprintf(stderr, "%s: energy_all: %f, energy_last: %f, vad_thold: %f, freq_thold: %f\n", __func__, energy_all, energy_last, vad_thold, freq_thold);
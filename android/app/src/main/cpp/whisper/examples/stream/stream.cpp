@@ -166,7 +166,7 @@ int main(int argc, char ** argv) {
         exit(0);
     }
 
-    struct whisper_context_params cparams;
+    struct whisper_context_params cparams = whisper_context_default_params();
     cparams.use_gpu = params.use_gpu;
 
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
@@ -177,6 +177,10 @@ int main(int argc, char ** argv) {
 
     std::vector<whisper_token> prompt_tokens;
 
+    // sliding window mode: every mel frame is computed once, as its audio arrives
+    struct whisper_mel_stream * mel = !use_vad && !params.speed_up ? whisper_mel_stream_init(ctx) : nullptr;
+    int64_t n_samples_total = 0;
+
     // print some info about the processing
     {
         fprintf(stderr, "\n");
@@ -271,6 +275,11 @@ int main(int argc, char ** argv) {
 
             const int n_samples_new = pcmf32_new.size();
 
+            if (mel) {
+                whisper_mel_stream_push(mel, pcmf32_new.data(), n_samples_new);
+            }
+            n_samples_total += n_samples_new;
+
             // take up to params.length_ms audio from previous iteration
             const int n_samples_take = std::min((int) pcmf32_old.size(), std::max(0, n_samples_keep + n_samples_len - n_samples_new));
 
@@ -334,7 +343,22 @@ int main(int argc, char ** argv) {
             wparams.prompt_tokens    = params.no_context ? nullptr : prompt_tokens.data();
             wparams.prompt_n_tokens  = params.no_context ? 0       : prompt_tokens.size();
 
-            if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            int ret = 0;
+            if (mel) {
+                // pcmf32 is the window that ends with the newest audio
+                const int64_t t0 = n_samples_total - pcmf32.size();
+
+                ret = whisper_mel_stream_set(ctx, mel, t0, n_samples_total);
+                if (ret == 0) {
+                    ret = whisper_full(ctx, wparams, nullptr, 0);
+                }
+
+                whisper_mel_stream_discard(mel, t0);
+            } else {
+                ret = whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size());
+            }
+
+            if (ret != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 6;
             }
@@ -426,6 +450,8 @@ int main(int argc, char ** argv) {
 
     audio.pause();
 
+    whisper_mel_stream_free(mel);
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
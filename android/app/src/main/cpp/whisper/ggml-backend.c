@@ -542,8 +542,29 @@ struct ggml_backend_cpu_context {
     int n_threads;
     void * work_data;
     size_t work_size;
+
+    struct ggml_threadpool * threadpool; // created on first use, grown when n_threads exceeds it
+    int * cpus;
+    int   n_cpus;
 };
 
+static struct ggml_threadpool * ggml_backend_cpu_get_threadpool(struct ggml_backend_cpu_context * cpu_ctx) {
+    if (cpu_ctx->n_threads <= 1) {
+        return cpu_ctx->threadpool;
+    }
+
+    if (ggml_threadpool_n_threads(cpu_ctx->threadpool) < cpu_ctx->n_threads) {
+        struct ggml_threadpool_params params = ggml_threadpool_default_params(cpu_ctx->n_threads);
+        params.cpus   = cpu_ctx->cpus;
+        params.n_cpus = cpu_ctx->n_cpus;
+
+        ggml_threadpool_free(cpu_ctx->threadpool);
+        cpu_ctx->threadpool = ggml_threadpool_new(params);
+    }
+
+    return cpu_ctx->threadpool;
+}
+
 static const char * ggml_backend_cpu_name(ggml_backend_t backend) {
     return "CPU";
 
@@ -552,6 +573,8 @@ static const char * ggml_backend_cpu_name(ggml_backend_t backend) {
 
 static void ggml_backend_cpu_free(ggml_backend_t backend) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    ggml_threadpool_free(cpu_ctx->threadpool);
+    free(cpu_ctx->cpus);
     free(cpu_ctx->work_data);
     free(cpu_ctx);
     free(backend);
@@ -593,11 +616,13 @@ static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, ggml_backen
 }
 
 static void ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
+    struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
+    // looked up at compute time, the pool may have been recreated since the plan was made
+    cpu_plan->cplan.threadpool = ggml_backend_cpu_get_threadpool(cpu_ctx);
 
-    GGML_UNUSED(backend);
+    ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
 }
 
 static bool ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
@@ -611,7 +636,8 @@ static bool ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_c
         cpu_ctx->work_size = cplan.work_size;
     }
 
-    cplan.work_data = cpu_ctx->work_data;
+    cplan.work_data  = cpu_ctx->work_data;
+    cplan.threadpool = ggml_backend_cpu_get_threadpool(cpu_ctx);
 
     ggml_graph_compute(cgraph, &cplan);
     return true;
@@ -650,6 +676,9 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->n_threads = GGML_DEFAULT_N_THREADS;
     ctx->work_data = NULL;
     ctx->work_size = 0;
+    ctx->threadpool = NULL;
+    ctx->cpus = NULL;
+    ctx->n_cpus = 0;
 
     ggml_backend_t cpu_backend = malloc(sizeof(struct ggml_backend));
 
@@ -671,6 +700,26 @@ void ggml_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads) {
     ctx->n_threads = n_threads;
 }
 
+void ggml_backend_cpu_set_affinity(ggml_backend_t backend_cpu, const int * cpus, int n_cpus) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+
+    free(ctx->cpus);
+    ctx->cpus   = NULL;
+    ctx->n_cpus = 0;
+
+    if (cpus && n_cpus > 0) {
+        ctx->cpus   = malloc(sizeof(int)*n_cpus);
+        ctx->n_cpus = n_cpus;
+        memcpy(ctx->cpus, cpus, sizeof(int)*n_cpus);
+    }
+
+    // the workers pin themselves when they start, so start new ones
+    ggml_threadpool_free(ctx->threadpool);
+    ctx->threadpool = NULL;
+}
+
 ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size) {
     return ggml_backend_buffer_init(ggml_backend_cpu_buffer_type(), cpu_backend_buffer_i_from_ptr, ptr, size);
 }
@@ -74,6 +74,10 @@ extern "C" {
     GGML_API bool ggml_backend_is_cpu(ggml_backend_t backend);
     GGML_API void ggml_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads);
 
+    // restrict the backend's persistent compute threads to the given CPUs (NULL or 0 to lift the restriction)
+    // the thread calling ggml_backend_graph_compute() is left as it is
+    GGML_API void ggml_backend_cpu_set_affinity(ggml_backend_t backend_cpu, const int * cpus, int n_cpus);
+
     // Create a backend buffer from an existing pointer
     GGML_API ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size);
 
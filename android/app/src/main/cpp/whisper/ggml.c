@@ -94,6 +94,11 @@ typedef void * thread_ret_t;
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #endif
 
 #ifdef GGML_USE_CPU_HBM
@@ -16220,6 +16225,7 @@ struct ggml_compute_state {
     ggml_thread_t thrd;
     int ith;
     struct ggml_compute_state_shared * shared;
+    struct ggml_threadpool * threadpool; // owning pool for persistent workers, NULL otherwise
 };
 
 static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
@@ -16777,6 +16783,296 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
     return cplan;
 }
 
+//
+// persistent compute threads
+//
+// workers wait for the job word to change: they poll it for spin_us and then park on a futex
+// (a condition variable where there are no futexes). the job word packs a sequence number
+// with the number of threads the next graph uses, so a worker reads both in one load and a
+// worker that is not needed for a graph goes straight back to waiting
+//
+
+#define GGML_THREADPOOL_MAX_THREADS 255 // the thread count lives in the low 8 bits of the job word
+#define GGML_THREADPOOL_SPIN_US     500
+
+struct ggml_threadpool_params ggml_threadpool_default_params(int n_threads) {
+    struct ggml_threadpool_params params = {
+        /*.n_threads =*/ n_threads,
+        /*.spin_us   =*/ GGML_THREADPOOL_SPIN_US,
+        /*.cpus      =*/ NULL,
+        /*.n_cpus    =*/ 0,
+    };
+
+    return params;
+}
+
+#if !defined(_WIN32)
+
+struct ggml_threadpool {
+    int n_threads;
+    int spin_us;
+
+    int   n_cpus;
+    int * cpus;
+
+    struct ggml_compute_state * workers; // [n_threads], workers[0] is the thread calling ggml_graph_compute
+
+    atomic_int job;      // (seq << 8) | n_threads of the current graph
+    atomic_int n_parked; // workers blocked in ggml_threadpool_park()
+    atomic_int n_done;   // workers finished with the current graph
+    atomic_int stop;
+
+#if !defined(__linux__)
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+#endif
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ggml_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define ggml_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define ggml_cpu_relax()
+#endif
+
+#if defined(__linux__)
+static void ggml_threadpool_park(struct ggml_threadpool * threadpool, int job) {
+    syscall(SYS_futex, (void *) (uintptr_t) &threadpool->job, FUTEX_WAIT_PRIVATE, job, NULL, NULL, 0);
+}
+
+static void ggml_threadpool_wake(struct ggml_threadpool * threadpool) {
+    syscall(SYS_futex, (void *) (uintptr_t) &threadpool->job, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void ggml_threadpool_set_affinity(const struct ggml_threadpool * threadpool) {
+    if (threadpool->n_cpus == 0) {
+        return;
+    }
+
+    // raw syscall: bionic has no pthread_setaffinity_np() and cpu_set_t needs _GNU_SOURCE
+    enum { bits = 8*sizeof(unsigned long) };
+    unsigned long mask[1024/bits] = { 0 };
+
+    for (int i = 0; i < threadpool->n_cpus; ++i) {
+        const int cpu = threadpool->cpus[i];
+        if (cpu >= 0 && cpu < 1024) {
+            mask[cpu/bits] |= 1UL << (cpu%bits);
+        }
+    }
+
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0) {
+        fprintf(stderr, "warning: sched_setaffinity() failed: %s\n", strerror(errno));
+    }
+}
+#else
+static void ggml_threadpool_park(struct ggml_threadpool * threadpool, int job) {
+    pthread_mutex_lock(&threadpool->mutex);
+    if (atomic_load(&threadpool->job) == job) {
+        pthread_cond_wait(&threadpool->cond, &threadpool->mutex);
+    }
+    pthread_mutex_unlock(&threadpool->mutex);
+}
+
+static void ggml_threadpool_wake(struct ggml_threadpool * threadpool) {
+    pthread_mutex_lock(&threadpool->mutex);
+    pthread_cond_broadcast(&threadpool->cond);
+    pthread_mutex_unlock(&threadpool->mutex);
+}
+
+static void ggml_threadpool_set_affinity(const struct ggml_threadpool * threadpool) { UNUSED(threadpool); }
+#endif
+
+// returns the first job word that differs from seen
+static int ggml_threadpool_wait(struct ggml_threadpool * threadpool, int seen) {
+    const int64_t t_end = ggml_time_us() + threadpool->spin_us;
+
+    for (int i = 0; ; ++i) {
+        const int job = atomic_load(&threadpool->job);
+        if (job != seen) {
+            return job;
+        }
+        if ((i & 63) == 63 && ggml_time_us() >= t_end) {
+            break;
+        }
+        ggml_cpu_relax();
+    }
+
+    // the kicking thread reads n_parked after publishing the job, so either it sees this
+    // increment and wakes us, or we see its job below and never sleep
+    atomic_fetch_add(&threadpool->n_parked, 1);
+
+    int job;
+    while ((job = atomic_load(&threadpool->job)) == seen) {
+        ggml_threadpool_park(threadpool, seen);
+    }
+
+    atomic_fetch_sub(&threadpool->n_parked, 1);
+
+    return job;
+}
+
+static void ggml_threadpool_kick(struct ggml_threadpool * threadpool, int n_threads) {
+    const unsigned seq = ((unsigned) atomic_load(&threadpool->job) >> 8) + 1;
+
+    atomic_store(&threadpool->job, (int) ((seq << 8) | (unsigned) n_threads));
+
+    if (atomic_load(&threadpool->n_parked) > 0) {
+        ggml_threadpool_wake(threadpool);
+    }
+}
+
+static thread_ret_t ggml_threadpool_worker(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * threadpool = state->threadpool;
+
+    ggml_threadpool_set_affinity(threadpool);
+
+    int job = 0;
+
+    while (true) {
+        job = ggml_threadpool_wait(threadpool, job);
+
+        if (atomic_load(&threadpool->stop)) {
+            break;
+        }
+
+        if (state->ith < (job & 0xff)) {
+            ggml_graph_compute_thread(state);
+            atomic_fetch_add(&threadpool->n_done, 1);
+        }
+    }
+
+    return 0;
+}
+
+struct ggml_threadpool * ggml_threadpool_new(struct ggml_threadpool_params params) {
+    const int n_threads = MIN(MAX(params.n_threads, 1), GGML_THREADPOOL_MAX_THREADS);
+
+    struct ggml_threadpool * threadpool = malloc(sizeof(struct ggml_threadpool));
+
+    threadpool->n_threads = n_threads;
+    threadpool->spin_us   = MAX(params.spin_us, 0);
+    threadpool->n_cpus    = params.cpus ? params.n_cpus : 0;
+    threadpool->cpus      = NULL;
+    threadpool->workers   = malloc(sizeof(struct ggml_compute_state)*n_threads);
+
+    if (threadpool->n_cpus > 0) {
+        threadpool->cpus = malloc(sizeof(int)*threadpool->n_cpus);
+        memcpy(threadpool->cpus, params.cpus, sizeof(int)*threadpool->n_cpus);
+    }
+
+    atomic_store(&threadpool->job,      0);
+    atomic_store(&threadpool->n_parked, 0);
+    atomic_store(&threadpool->n_done,   0);
+    atomic_store(&threadpool->stop,     0);
+
+#if !defined(__linux__)
+    pthread_mutex_init(&threadpool->mutex, NULL);
+    pthread_cond_init (&threadpool->cond,  NULL);
+#endif
+
+    for (int j = 0; j < n_threads; ++j) {
+        threadpool->workers[j] = (struct ggml_compute_state) {
+            .thrd       = 0,
+            .ith        = j,
+            .shared     = NULL,
+            .threadpool = threadpool,
+        };
+
+        if (j > 0) {
+            const int rc = ggml_thread_create(&threadpool->workers[j].thrd, NULL, ggml_threadpool_worker, &threadpool->workers[j]);
+            GGML_ASSERT(rc == 0);
+            UNUSED(rc);
+        }
+    }
+
+    return threadpool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * threadpool) {
+    if (threadpool == NULL) {
+        return;
+    }
+
+    atomic_store(&threadpool->stop, 1);
+    ggml_threadpool_kick(threadpool, 0);
+
+    for (int j = 1; j < threadpool->n_threads; ++j) {
+        const int rc = ggml_thread_join(threadpool->workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+#if !defined(__linux__)
+    pthread_mutex_destroy(&threadpool->mutex);
+    pthread_cond_destroy (&threadpool->cond);
+#endif
+
+    free(threadpool->cpus);
+    free(threadpool->workers);
+    free(threadpool);
+}
+
+// hand the graph to workers 1 .. n_threads-1, the caller runs worker 0 itself
+static void ggml_threadpool_begin(struct ggml_threadpool * threadpool, struct ggml_compute_state_shared * shared, int n_threads) {
+    for (int j = 1; j < n_threads; ++j) {
+        threadpool->workers[j].shared = shared;
+    }
+
+    atomic_store(&threadpool->n_done, 0);
+    ggml_threadpool_kick(threadpool, n_threads);
+}
+
+// the workers usually leave the graph together with the caller, so this barely spins. a worker
+// that was descheduled (e.g. on a little core) can take a while though, so after spin_us the
+// caller yields its core instead of burning it
+static void ggml_threadpool_end(struct ggml_threadpool * threadpool, int n_threads) {
+    const int64_t t_end = ggml_time_us() + threadpool->spin_us;
+
+    bool spin = true;
+
+    for (int i = 0; atomic_load(&threadpool->n_done) < n_threads - 1; ++i) {
+        if (!spin) {
+            sched_yield();
+            continue;
+        }
+        if ((i & 63) == 63 && ggml_time_us() >= t_end) {
+            spin = false;
+        }
+        ggml_cpu_relax();
+    }
+}
+
+#else
+
+struct ggml_threadpool {
+    int n_threads;
+};
+
+struct ggml_threadpool * ggml_threadpool_new(struct ggml_threadpool_params params) {
+    UNUSED(params);
+    return NULL;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * threadpool) {
+    UNUSED(threadpool);
+}
+
+static void ggml_threadpool_begin(struct ggml_threadpool * threadpool, struct ggml_compute_state_shared * shared, int n_threads) {
+    UNUSED(threadpool); UNUSED(shared); UNUSED(n_threads);
+}
+
+static void ggml_threadpool_end(struct ggml_threadpool * threadpool, int n_threads) {
+    UNUSED(threadpool); UNUSED(n_threads);
+}
+
+#endif
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool) {
+    return threadpool ? threadpool->n_threads : 0;
+}
+
 int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     {
         GGML_ASSERT(cplan);
@@ -16802,13 +17098,22 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     };
     struct ggml_compute_state * workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
 
+    // a persistent pool is only used when it has enough workers for this plan
+    struct ggml_threadpool * threadpool = cplan->threadpool;
+    if (n_threads == 1 || n_threads > ggml_threadpool_n_threads(threadpool)) {
+        threadpool = NULL;
+    }
+
     // create thread pool
-    if (n_threads > 1) {
+    if (threadpool) {
+        ggml_threadpool_begin(threadpool, &state_shared, n_threads);
+    } else if (n_threads > 1) {
         for (int j = 1; j < n_threads; ++j) {
             workers[j] = (struct ggml_compute_state) {
                 .thrd   = 0,
                 .ith = j,
                 .shared = &state_shared,
+                .threadpool = NULL,
             };
 
             const int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
@@ -16819,6 +17124,7 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
 
     workers[0].ith = 0;
     workers[0].shared = &state_shared;
+    workers[0].threadpool = threadpool;
 
     const int64_t perf_start_cycles  = ggml_perf_cycles();
     const int64_t perf_start_time_us = ggml_perf_time_us();
@@ -16830,7 +17136,9 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     clear_numa_thread_affinity();
 
     // join or kill thread pool
-    if (n_threads > 1) {
+    if (threadpool) {
+        ggml_threadpool_end(threadpool, n_threads);
+    } else if (n_threads > 1) {
         for (int j = 1; j < n_threads; j++) {
             const int rc = ggml_thread_join(workers[j].thrd, NULL);
             GGML_ASSERT(rc == 0);
@@ -320,6 +320,7 @@ extern "C" {
 
     struct ggml_object;
     struct ggml_context;
+    struct ggml_threadpool;
 
     enum ggml_type {
         GGML_TYPE_F32  = 0,
@@ -555,6 +556,9 @@ extern "C" {
 
         int n_threads;
 
+        // persistent worker threads to run the graph on, NULL to create and join threads for this graph only
+        struct ggml_threadpool * threadpool;
+
         // abort ggml_graph_compute when true
         bool (*abort_callback)(void * data);
         void * abort_callback_data;
@@ -1850,6 +1854,21 @@ extern "C" {
     GGML_API struct ggml_cplan ggml_graph_plan   (struct ggml_cgraph * cgraph, int n_threads /*= GGML_DEFAULT_N_THREADS*/);
     GGML_API int               ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan);
 
+    // persistent compute threads, reused by every ggml_graph_compute() whose plan points at them
+    // idle workers spin for spin_us after a graph finishes and then park until the next one
+    // not available on Windows, where ggml_threadpool_new() returns NULL
+    struct ggml_threadpool_params {
+        int         n_threads; // including the thread that calls ggml_graph_compute()
+        int         spin_us;   // how long an idle worker polls before it parks
+        const int * cpus;      // CPUs the workers may run on, NULL for no restriction
+        int         n_cpus;
+    };
+
+    GGML_API struct ggml_threadpool_params ggml_threadpool_default_params(int n_threads);
+    GGML_API struct ggml_threadpool *      ggml_threadpool_new      (struct ggml_threadpool_params params);
+    GGML_API void                          ggml_threadpool_free     (struct ggml_threadpool * threadpool);
+    GGML_API int                           ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool);
+
     // same as ggml_graph_compute() but the work data is allocated as a part of the context
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_API void ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
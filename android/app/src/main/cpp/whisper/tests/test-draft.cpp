@@ -0,0 +1,190 @@
+// Compares speculative greedy decoding (whisper_full_params.draft) with plain greedy decoding on a model pair.
+//
+// The verify step decodes the last sampled token and the draft tokens as a single batch, which attends over more
+// cache cells than a one-token step. The tokens and their probabilities are checked bit for bit, and the first
+// difference is reported together with the probability that plain decoding gave its token there.
+//
+// usage: test-draft -m MODEL -md DRAFT_MODEL -f WAV [-nd N_DRAFT] [-t N_THREADS] [-nf]
+
+#include "common.h"
+
+#include "whisper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct test_params {
+    int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t n_draft   = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).draft.n_draft;
+
+    bool no_fallback = false;
+
+    std::string model;
+    std::string model_draft;
+    std::string fname_inp;
+};
+
+static void test_print_usage(int /*argc*/, char ** argv, const test_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options] -m MODEL -md DRAFT_MODEL -f WAV\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,        --help              [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,      --threads N         [%-7d] number of threads to use during computation\n", params.n_threads);
+    fprintf(stderr, "  -nd N,     --n-draft N         [%-7d] number of tokens to draft per decoder call\n",  params.n_draft);
+    fprintf(stderr, "  -nf,       --no-fallback       [%-7s] do not use temperature fallback while decoding\n", params.no_fallback ? "true" : "false");
+    fprintf(stderr, "  -m FNAME,  --model FNAME       [%-7s] model path\n",                                  params.model.c_str());
+    fprintf(stderr, "  -md FNAME, --model-draft FNAME [%-7s] draft model path\n",                            params.model_draft.c_str());
+    fprintf(stderr, "  -f FNAME,  --file FNAME        [%-7s] input WAV file path\n",                         params.fname_inp.c_str());
+    fprintf(stderr, "\n");
+}
+
+static bool test_params_parse(int argc, char ** argv, test_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            test_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-t"  || arg == "--threads")     { params.n_threads   = std::stoi(argv[++i]); }
+        else if (arg == "-nd" || arg == "--n-draft")     { params.n_draft     = std::stoi(argv[++i]); }
+        else if (arg == "-nf" || arg == "--no-fallback") { params.no_fallback = true; }
+        else if (arg == "-m"  || arg == "--model")       { params.model       = argv[++i]; }
+        else if (arg == "-md" || arg == "--model-draft") { params.model_draft = argv[++i]; }
+        else if (arg == "-f"  || arg == "--file")        { params.fname_inp   = argv[++i]; }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            test_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return !params.model.empty() && !params.model_draft.empty() && !params.fname_inp.empty();
+}
+
+// all tokens of all segments, special tokens included, with the given state or the default state of the context
+// each run needs a state of its own, the text context and the random numbers of a state carry over between calls
+static bool test_transcribe(
+                  whisper_context * ctx,
+                    whisper_state * state,
+                  whisper_context * ctx_draft,
+                const test_params & params,
+         const std::vector<float> & pcmf32,
+  std::vector<whisper_token_data> & tokens) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads       = params.n_threads;
+    wparams.print_progress  = false;
+    wparams.temperature_inc = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+    wparams.draft.ctx     = ctx_draft;
+    wparams.draft.n_draft = params.n_draft;
+
+    if (state) {
+        if (whisper_full_with_state(ctx, state, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            return false;
+        }
+    } else {
+        if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            return false;
+        }
+    }
+
+    tokens.clear();
+
+    const int n_segments = state ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+
+    for (int i = 0; i < n_segments; ++i) {
+        const int n_tokens = state ? whisper_full_n_tokens_from_state(state, i) : whisper_full_n_tokens(ctx, i);
+
+        for (int j = 0; j < n_tokens; ++j) {
+            tokens.push_back(state ? whisper_full_get_token_data_from_state(state, i, j) : whisper_full_get_token_data(ctx, i, j));
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    test_params params;
+
+    if (!test_params_parse(argc, argv, params)) {
+        test_print_usage(argc, argv, params);
+        return 1;
+    }
+
+    std::vector<float> pcmf32;
+    std::vector<std::vector<float>> pcmf32s;
+
+    if (!::read_wav(params.fname_inp, pcmf32, pcmf32s, false)) {
+        fprintf(stderr, "error: failed to read WAV file '%s'\n", params.fname_inp.c_str());
+        return 1;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    struct whisper_context * ctx       = whisper_init_from_file_with_params(params.model.c_str(),       cparams);
+    struct whisper_context * ctx_draft = whisper_init_from_file_with_params(params.model_draft.c_str(), cparams);
+
+    if (ctx == nullptr || ctx_draft == nullptr) {
+        fprintf(stderr, "error: failed to initialize the whisper contexts\n");
+        return 1;
+    }
+
+    // the default state is left for the run with the draft model, whose counters whisper_print_timings() reports
+    struct whisper_state * state_plain = whisper_init_state(ctx);
+
+    if (state_plain == nullptr) {
+        fprintf(stderr, "error: failed to initialize the whisper state\n");
+        return 1;
+    }
+
+    std::vector<whisper_token_data> tokens_plain;
+    std::vector<whisper_token_data> tokens_draft;
+
+    if (!test_transcribe(ctx, state_plain, nullptr, params, pcmf32, tokens_plain)) {
+        fprintf(stderr, "error: failed to process audio without the draft model\n");
+        return 1;
+    }
+
+    if (!test_transcribe(ctx, nullptr, ctx_draft, params, pcmf32, tokens_draft)) {
+        fprintf(stderr, "error: failed to process audio with the draft model\n");
+        return 1;
+    }
+
+    // the draft tokens accepted by the model
+    whisper_print_timings(ctx);
+
+    size_t n_same = 0;
+    while (n_same < tokens_plain.size() && n_same < tokens_draft.size() &&
+            tokens_plain[n_same].id == tokens_draft[n_same].id &&
+            tokens_plain[n_same].p  == tokens_draft[n_same].p) {
+        n_same++;
+    }
+
+    const bool ok = n_same == tokens_plain.size() && n_same == tokens_draft.size();
+
+    fprintf(stderr, "\n%s: n_draft = %d, %zu tokens without the draft model, %zu with it, %zu identical\n",
+            __func__, params.n_draft, tokens_plain.size(), tokens_draft.size(), n_same);
+
+    if (!ok && n_same < tokens_plain.size() && n_same < tokens_draft.size()) {
+        const auto & a = tokens_plain[n_same];
+        const auto & b = tokens_draft[n_same];
+
+        fprintf(stderr, "%s: first difference at token %zu: '%s' (p = %.9f) without the draft model, '%s' (p = %.9f) with it\n",
+                __func__, n_same, whisper_token_to_str(ctx, a.id), a.p, whisper_token_to_str(ctx, b.id), b.p);
+    }
+
+    fprintf(stderr, "%s: %s\n", __func__, ok ? "PASSED" : "FAILED");
+
+    whisper_free_state(state_plain);
+
+    whisper_free(ctx_draft);
+    whisper_free(ctx);
+
+    return ok ? 0 : 1;
+}
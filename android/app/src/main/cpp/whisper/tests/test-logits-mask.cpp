@@ -0,0 +1,269 @@
+// Checks that the logit suppression rules resolved once per whisper_full() call (whisper_logits_mask) leave
+// whisper_process_logits() with the same logits as the rules it used to apply at every step.
+//
+// The static helpers are only reachable from the translation unit itself, so it is included here. No model is
+// needed: the vocabulary is synthetic, with the non-speech tokens and " " at known ids.
+
+#include "whisper.cpp"
+
+#include <cstdio>
+
+// the per-step rules that whisper_logits_mask replaced, in their original order around the callback
+static void reference_suppress_before_callback(
+              whisper_context & ctx,
+    const whisper_full_params & params,
+                         bool   is_initial,
+                        float * logits) {
+    const auto & vocab = ctx.vocab;
+
+    const int n_logits = vocab.n_vocab;
+
+    if (params.suppress_blank) {
+        if (is_initial) {
+            logits[vocab.token_eot] = -INFINITY;
+
+            const whisper_token space = vocab.find(" ");
+            if (space >= 0) {
+                logits[space] = -INFINITY;
+            }
+        }
+    }
+
+    logits[vocab.token_not] = -INFINITY;
+    if (params.no_timestamps) {
+        for (int i = vocab.token_beg; i < n_logits; ++i) {
+            logits[i] = -INFINITY;
+        }
+    }
+
+    logits[vocab.token_sot]  = -INFINITY;
+    logits[vocab.token_nosp] = -INFINITY;
+
+    if (params.tdrz_enable == false) {
+        logits[vocab.token_solm] = -INFINITY;
+    }
+
+    logits[vocab.token_translate]  = -INFINITY;
+    logits[vocab.token_transcribe] = -INFINITY;
+    logits[vocab.token_prev]       = -INFINITY;
+
+    for (size_t i = 0; i < g_lang.size(); ++i) {
+        logits[whisper_token_lang(&ctx, i)] = -INFINITY;
+    }
+}
+
+static void reference_suppress_after_callback(
+        const whisper_context & ctx,
+    const whisper_full_params & params,
+                        float * logits) {
+    const auto & vocab = ctx.vocab;
+
+    if (params.suppress_non_speech_tokens) {
+        for (const std::string & token : non_speech_tokens) {
+            const std::string suppress_tokens[] = {token, " " + token};
+            for (const std::string & suppress_token : suppress_tokens) {
+                const whisper_token id = vocab.find(suppress_token);
+                if (id >= 0) {
+                    logits[id] = -INFINITY;
+                }
+            }
+        }
+
+        for (const char * token : { " -", " '" }) {
+            const whisper_token id = vocab.find(token);
+            if (id >= 0) {
+                logits[id] = -INFINITY;
+            }
+        }
+    }
+}
+
+// same ids as whisper_model_load() assigns for a vocabulary of n_vocab tokens
+static void init_vocab(whisper_context & ctx, int n_vocab) {
+    auto & vocab = ctx.vocab;
+
+    vocab = whisper_vocab();
+    vocab.n_vocab = n_vocab;
+
+    // every fifth non-speech spelling is left out of the vocabulary, like the ones real vocabularies lack
+    std::vector<std::string> words;
+    for (const auto & token : non_speech_tokens) {
+        words.push_back(words.size() % 5 == 4 ? "" : token);
+        words.push_back(words.size() % 5 == 4 ? "" : " " + token);
+    }
+    words.push_back(" -");
+    words.push_back(" '");
+
+    for (int i = 0; i < n_vocab; ++i) {
+        const int w = i - 1000;
+        if (i == 220) {
+            vocab.add(" ");
+        } else if (w >= 0 && w < (int) words.size() && !words[w].empty()) {
+            vocab.add(words[w]);
+        } else {
+            vocab.add("t" + std::to_string(i));
+        }
+    }
+    vocab.build_index();
+
+    if (vocab.is_multilingual()) {
+        vocab.token_eot++;
+        vocab.token_sot++;
+
+        const int dt = vocab.num_languages() - 98;
+
+        vocab.token_translate  += dt;
+        vocab.token_transcribe += dt;
+        vocab.token_solm       += dt;
+        vocab.token_prev       += dt;
+        vocab.token_nosp       += dt;
+        vocab.token_not        += dt;
+        vocab.token_beg        += dt;
+    }
+
+    ctx.model.hparams.n_vocab     = n_vocab;
+    ctx.model.hparams.n_audio_ctx = 1500;
+}
+
+struct callback_data {
+    const whisper_full_params * params;
+
+    bool apply_reference; // suppress the after-callback rules from the callback, for the reference run
+
+    std::vector<float> seen; // logits the callback was handed
+};
+
+static void logits_filter(
+        struct whisper_context * ctx,
+          struct whisper_state * /*state*/,
+      const whisper_token_data * /*tokens*/,
+                           int   /*n_tokens*/,
+                         float * logits,
+                          void * user_data) {
+    auto & data = *(callback_data *) user_data;
+
+    data.seen.assign(logits, logits + ctx->vocab.n_vocab);
+
+    if (data.apply_reference) {
+        reference_suppress_after_callback(*ctx, *data.params, logits);
+    }
+}
+
+static bool same(const std::vector<float> & a, const std::vector<float> & b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()*sizeof(float)) == 0;
+}
+
+int main() {
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    int n_tests  = 0;
+    int n_failed = 0;
+
+    for (const int n_vocab : { 51864, 51865 }) {
+        whisper_context ctx;
+        init_vocab(ctx, n_vocab);
+
+        whisper_state state;
+
+        std::mt19937 rng(n_vocab);
+        std::normal_distribution<float> dist(0.0f, 3.0f);
+
+        for (int flags = 0; flags < 64; ++flags) {
+            for (const int n_past : { 0, 1, 2 }) {
+                whisper_full_params params = whisper_full_default_params(
+                        flags & 32 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+                params.suppress_blank             = flags & 1;
+                params.suppress_non_speech_tokens = flags & 2;
+                params.no_timestamps              = flags & 4;
+                params.tdrz_enable                = flags & 8;
+
+                const float temperature = flags & 16 ? 0.4f : 0.0f;
+
+                std::vector<float> input(n_vocab);
+                for (auto & x : input) {
+                    x = dist(rng);
+                }
+
+                // push the timestamp rules around too
+                if (n_past == 2) {
+                    for (int i = ctx.vocab.token_beg; i < n_vocab; ++i) {
+                        input[i] += 8.0f;
+                    }
+                }
+
+                whisper_decoder decoder[2];
+
+                for (auto & d : decoder) {
+                    d.probs   .resize(n_vocab);
+                    d.logprobs.resize(n_vocab);
+
+                    for (int k = 0; k < n_past; ++k) {
+                        whisper_token_data token = {};
+                        token.id = k % 2 ? ctx.vocab.token_beg + 10 : 1000 + k;
+                        d.sequence.tokens.push_back(token);
+                    }
+
+                    d.i_batch    = 0;
+                    d.has_ts     = n_past > 1;
+                    d.seek_delta = 40;
+                    d.rng        = std::mt19937(flags);
+                }
+
+                callback_data data[2];
+
+                // 0: the per-step reference rules, with an empty mask
+                {
+                    state.logits = input;
+                    reference_suppress_before_callback(ctx, params, n_past == 0, state.logits.data());
+
+                    state.logits_mask = whisper_logits_mask();
+
+                    data[0] = { &params, true, {} };
+
+                    whisper_full_params params_ref = params;
+                    params_ref.logits_filter_callback           = logits_filter;
+                    params_ref.logits_filter_callback_user_data = &data[0];
+
+                    whisper_process_logits(ctx, state, decoder[0], params_ref, temperature);
+                }
+
+                // 1: the mask resolved once per call
+                {
+                    state.logits = input;
+
+                    whisper_logits_mask_init(state.logits_mask, ctx, params);
+
+                    data[1] = { &params, false, {} };
+
+                    whisper_full_params params_cur = params;
+                    params_cur.logits_filter_callback           = logits_filter;
+                    params_cur.logits_filter_callback_user_data = &data[1];
+
+                    whisper_process_logits(ctx, state, decoder[1], params_cur, temperature);
+                }
+
+                const bool is_greedy = params.strategy == WHISPER_SAMPLING_GREEDY && temperature < 1e-6f;
+
+                const bool ok =
+                    same(data[0].seen, data[1].seen) &&
+                    same(decoder[0].logits, decoder[1].logits) &&
+                    decoder[0].logsumexp == decoder[1].logsumexp &&
+                    (is_greedy || (same(decoder[0].probs, decoder[1].probs) && same(decoder[0].logprobs, decoder[1].logprobs)));
+
+                n_tests++;
+
+                if (!ok) {
+                    n_failed++;
+                    fprintf(stderr, "%s: FAILED: n_vocab = %d, blank = %d, non_speech = %d, no_timestamps = %d, tdrz = %d, t = %.1f, beam = %d, n_past = %d\n",
+                            __func__, n_vocab, params.suppress_blank, params.suppress_non_speech_tokens, params.no_timestamps,
+                            params.tdrz_enable, temperature, flags & 32 ? 1 : 0, n_past);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: %d / %d passed\n", __func__, n_tests - n_failed, n_tests);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -21,8 +21,10 @@
 #include "ggml-backend.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <cstdio>
@@ -34,9 +36,32 @@
 #include <string>
 #include <thread>
 #include <vector>
-#include <regex>
 #include <random>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#ifdef __has_include
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #if defined(_POSIX_MAPPED_FILES)
+            #include <sys/mman.h>
+            #include <sys/stat.h>
+            #include <fcntl.h>
+        #endif
+    #endif
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
@@ -360,6 +385,205 @@ struct whisper_filters {
     int32_t n_fft;
 
     std::vector<float> data;
+
+    // Sparse form of data, built at load time: filter j has its weights on bins [bin0[j], bin0[j] + n_bins[j]),
+    // packed at weights[offset[j]]. n_bins is padded with zero weights to a multiple of 4.
+    std::vector<int32_t> bin0;
+    std::vector<int32_t> n_bins;
+    std::vector<int32_t> offset;
+    std::vector<float>   weights;
+};
+
+// Double-array trie over the token strings, built once at load time. The child of state s along byte c is
+// t = base[s] + c + 1, which exists iff check[t] == s, so a step is two array reads with no search and no string
+// compares. The tokenizer finds the longest token at a position in a single walk.
+struct whisper_vocab_trie {
+    std::vector<int32_t> base;
+    std::vector<int32_t> check; // parent state, -1 for free slots
+    std::vector<int32_t> ids;   // token that ends at the state, -1 if none
+
+    // the key of id i is arena[offsets[i], offsets[i + 1] - 1); when several ids share a key the last one wins
+    void build(const std::string & arena, const std::vector<uint32_t> & offsets) {
+        const int32_t n_keys = (int32_t) offsets.size() - 1;
+
+        const auto key     = [&](int32_t i) { return (const uint8_t *) arena.data() + offsets[i]; };
+        const auto key_len = [&](int32_t i) { return offsets[i + 1] - offsets[i] - 1; };
+
+        // bytewise order, so that every state covers a contiguous range of keys
+        std::vector<int32_t> sorted(n_keys);
+        for (int32_t i = 0; i < n_keys; ++i) {
+            sorted[i] = i;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [&](int32_t a, int32_t b) {
+            const uint32_t la = key_len(a);
+            const uint32_t lb = key_len(b);
+            const int cmp = memcmp(key(a), key(b), std::min(la, lb));
+            return cmp != 0 ? cmp < 0 : la < lb;
+        });
+
+        struct range {
+            int32_t  begin;
+            int32_t  end;
+            uint32_t depth;
+            int32_t  state;
+        };
+
+        base .clear();
+        check.clear();
+        ids  .clear();
+
+        // free slots form a linked list while building, so that placing a state does not rescan the used ones
+        std::vector<int32_t> next_free;
+        std::vector<int32_t> prev_free;
+
+        int32_t head = -1;
+        int32_t tail = -1;
+
+        const auto grow = [&](size_t n) {
+            for (size_t t = check.size(); t < n; ++t) {
+                base     .push_back(0);
+                check    .push_back(-1);
+                ids      .push_back(-1);
+                next_free.push_back(-1);
+                prev_free.push_back(tail);
+
+                if (tail >= 0) {
+                    next_free[tail] = (int32_t) t;
+                } else {
+                    head = (int32_t) t;
+                }
+                tail = (int32_t) t;
+            }
+        };
+
+        const auto take = [&](int32_t t) {
+            if (prev_free[t] >= 0) { next_free[prev_free[t]] = next_free[t]; } else { head = next_free[t]; }
+            if (next_free[t] >= 0) { prev_free[next_free[t]] = prev_free[t]; } else { tail = prev_free[t]; }
+        };
+
+        grow(257);
+        take(0);
+        check[0] = -2; // the root is nobody's child
+
+        std::vector<range> queue = { { 0, n_keys, 0, 0 } };
+
+        std::vector<uint8_t> bytes;
+        std::vector<std::pair<int32_t, int32_t>> children; // key range of each child
+
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const range r = queue[q];
+
+            int32_t i = r.begin;
+            while (i < r.end && key_len(sorted[i]) == r.depth) {
+                ids[r.state] = sorted[i]; // equal keys are in id order, so the last one stays
+                ++i;
+            }
+
+            bytes.clear();
+            children.clear();
+            while (i < r.end) {
+                const uint8_t byte = key(sorted[i])[r.depth];
+
+                int32_t j = i + 1;
+                while (j < r.end && key(sorted[j])[r.depth] == byte) {
+                    ++j;
+                }
+
+                bytes.push_back(byte);
+                children.emplace_back(i, j);
+
+                i = j;
+            }
+
+            if (bytes.empty()) {
+                continue;
+            }
+
+            // lowest base that puts the first child on a free slot and every other child on one too
+            int32_t b = -1;
+            for (int32_t cell = head; b < 0; ) {
+                if (cell < 0) {
+                    const int32_t last = tail;
+                    grow(check.size() + 256);
+                    cell = last >= 0 ? next_free[last] : head;
+                }
+
+                const int32_t cand = cell - bytes[0] - 1;
+                if (cand >= 0) {
+                    grow((size_t) cand + 257);
+
+                    bool fits = true;
+                    for (uint8_t c : bytes) {
+                        if (check[cand + c + 1] != -1) {
+                            fits = false;
+                            break;
+                        }
+                    }
+                    if (fits) {
+                        b = cand;
+                    }
+                }
+
+                cell = next_free[cell];
+            }
+
+            base[r.state] = b;
+            for (size_t k = 0; k < bytes.size(); ++k) {
+                const int32_t t = b + bytes[k] + 1;
+                take(t);
+                check[t] = r.state;
+                queue.push_back({ children[k].first, children[k].second, r.depth + 1, t });
+            }
+        }
+
+        // slots past the last state are never reached
+        size_t n = check.size();
+        while (n > 1 && check[n - 1] == -1) {
+            --n;
+        }
+
+        base .resize(n);
+        check.resize(n);
+        ids  .resize(n);
+
+        base .shrink_to_fit();
+        check.shrink_to_fit();
+        ids  .shrink_to_fit();
+    }
+
+    // child of state s along byte c, or -1
+    int32_t child(int32_t s, uint8_t c) const {
+        const size_t t = (size_t) base[s] + c + 1;
+        return t < check.size() && check[t] == s ? (int32_t) t : -1;
+    }
+
+    // id of the key s[0, n), -1 if there is none
+    int32_t find(const char * s, size_t n) const {
+        int32_t cur = 0;
+        for (size_t i = 0; i < n && cur >= 0; ++i) {
+            cur = child(cur, (uint8_t) s[i]);
+        }
+        return n > 0 && cur >= 0 ? ids[cur] : -1;
+    }
+
+    // length of the longest non-empty key that s[0, n) starts with, 0 if there is none
+    int longest_prefix(const char * s, int n, int32_t & id) const {
+        int len = 0;
+
+        int32_t cur = 0;
+        for (int i = 0; i < n; ++i) {
+            cur = child(cur, (uint8_t) s[i]);
+            if (cur < 0) {
+                break;
+            }
+            if (ids[cur] >= 0) {
+                id  = ids[cur];
+                len = i + 1;
+            }
+        }
+
+        return len;
+    }
 };
 
 struct whisper_vocab {
@@ -368,8 +592,12 @@ struct whisper_vocab {
 
     int n_vocab = 51864;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    // Token strings packed back to back, each followed by a 0 so that it can be handed out as a C string.
+    // The text of token i is text[offsets[i], offsets[i + 1] - 1).
+    std::string           text;
+    std::vector<uint32_t> offsets = { 0 };
+
+    whisper_vocab_trie trie; // text -> id, see build_index()
 
     // reference: https://github.com/openai/whisper/blob/248b6cb124225dd263bb9bd32d060b6517e067f8/whisper/tokenizer.py#L334-L349
     id token_eot        = 50256;
@@ -384,6 +612,36 @@ struct whisper_vocab {
     id token_not        = 50362; // no timestamps
     id token_beg        = 50363; // begin timestamps
 
+    // appends the token with the next id
+    void add(const std::string & token) {
+        text.append(token);
+        text.push_back(0);
+        offsets.push_back((uint32_t) text.size());
+    }
+
+    // call once all tokens are added
+    void build_index() {
+        trie.build(text, offsets);
+    }
+
+    int size() const {
+        return (int) offsets.size() - 1;
+    }
+
+    // text of token i, "" for ids outside the vocabulary
+    const char * token_text(id i) const {
+        return i >= 0 && i < size() ? text.data() + offsets[i] : "";
+    }
+
+    std::string token_str(id i) const {
+        return i >= 0 && i < size() ? std::string(text.data() + offsets[i], offsets[i + 1] - offsets[i] - 1) : std::string();
+    }
+
+    // id of the token spelled exactly str, -1 if there is none
+    id find(const std::string & str) const {
+        return trie.find(str.data(), str.size());
+    }
+
     bool is_multilingual() const {
         return n_vocab >= 51865;
     }
@@ -475,7 +733,7 @@ struct whisper_allocr {
 
     std::vector<uint8_t> meta;
 
-    ggml_backend_buffer_t buffer;
+    ggml_backend_buffer_t buffer = nullptr;
 };
 
 static size_t whisper_allocr_size(struct whisper_allocr & allocr) {
@@ -494,10 +752,10 @@ static void whisper_allocr_graph_init(struct whisper_allocr & allocr, ggml_backe
     ggml_allocr_alloc_graph(alloc, get_graph());
 }
 
-static void whisper_allocr_graph_realloc(struct whisper_allocr & allocr, ggml_backend_t backend) {
+static bool whisper_allocr_graph_realloc(struct whisper_allocr & allocr, ggml_backend_t backend) {
     if (allocr.alloc == nullptr) {
         // this can be null if we use external encoder like CoreML or OpenVINO
-        return;
+        return true;
     }
 
     auto & alloc  = allocr.alloc;
@@ -506,9 +764,17 @@ static void whisper_allocr_graph_realloc(struct whisper_allocr & allocr, ggml_ba
     size_t size = ggml_allocr_max_size(alloc);
 
     ggml_allocr_free(alloc);
+    alloc = nullptr;
 
     buffer = ggml_backend_alloc_buffer(backend, size);
+    if (buffer == nullptr) {
+        WHISPER_LOG_ERROR("%s: failed to allocate compute buffer of %zu bytes\n", __func__, size);
+        return false;
+    }
+
     alloc = ggml_allocr_new_from_buffer(buffer);
+
+    return true;
 }
 
 static void whisper_allocr_free(struct whisper_allocr & allocr) {
@@ -703,6 +969,9 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     struct ggml_backend_buffer * buffer;
 
+    // wraps the memory-mapped model file for tensors whose data is used in place
+    struct ggml_backend_buffer * buffer_mmap = nullptr;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -756,16 +1025,259 @@ struct whisper_decoder {
     bool has_ts;    // have we already sampled a non-beg timestamp token for the current segment?
 
     // new token probs, logits and logprobs after the last whisper_decode (1-dimensional array: [n_vocab])
+    // greedy decoding at temperature 0 only needs the logits, so probs and logprobs are not filled in that case
     std::vector<float> probs;
     std::vector<float> logits;
     std::vector<float> logprobs;
 
+    float logsumexp; // log of the softmax denominator: logprobs[i] = logits[i] - logsumexp
+
     // work container used to avoid memory allocations
     std::vector<whisper_pair<double, whisper_vocab::id>> logits_id;
 
     mutable std::mt19937 rng; // used for sampling at t > 0.0
 };
 
+// tokens that whisper_process_logits() suppresses regardless of the decoded sequence,
+// resolved from the vocabulary once per whisper_full() call instead of at every step
+struct whisper_logits_mask {
+    std::vector<whisper_token> special;    // special, task and language tokens, applied before logits_filter_callback
+    std::vector<whisper_token> non_speech; // params.suppress_non_speech_tokens, applied after the callback
+    std::vector<whisper_token> blank;      // params.suppress_blank, applied to the first token only
+};
+
+//
+// CPU topology
+//
+// A ggml graph node finishes when its slowest thread does, so on heterogeneous (big.LITTLE) CPUs a single compute
+// thread scheduled on an efficiency core holds back all the others. whisper keeps its threads on the performance
+// cores: the CPUs faster than the slowest cluster, ranked by the scheduler's cpu_capacity or else by
+// cpuinfo_max_freq.
+//
+
+struct whisper_cpu_topology {
+    int n_cpus = 0;
+
+    std::vector<int> perf; // performance cores, every CPU when the cores are alike or nothing is known about them
+};
+
+// clusters within this ratio of the fastest one count as equal (e.g. per-core turbo limits on desktop CPUs)
+#define WHISPER_CPU_PERF_RATIO 0.8
+
+static whisper_cpu_topology whisper_cpu_topology_probe() {
+    whisper_cpu_topology topo;
+
+#if defined(__linux__)
+    std::vector<std::pair<int, long>> speed;
+
+    const long n_conf = sysconf(_SC_NPROCESSORS_CONF);
+    for (int cpu = 0; cpu < n_conf; ++cpu) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+
+        long value = -1;
+        for (const char * name : { "/cpu_capacity", "/cpufreq/cpuinfo_max_freq" }) {
+            std::ifstream fin(dir + name);
+            if (fin >> value && value > 0) {
+                break;
+            }
+            value = -1;
+        }
+
+        if (value > 0) {
+            speed.emplace_back(cpu, value);
+        }
+    }
+
+    if (!speed.empty()) {
+        long slowest = speed[0].second;
+        long fastest = speed[0].second;
+        for (const auto & cs : speed) {
+            slowest = std::min(slowest, cs.second);
+            fastest = std::max(fastest, cs.second);
+        }
+
+        const bool alike = slowest >= WHISPER_CPU_PERF_RATIO*fastest;
+
+        topo.n_cpus = (int) speed.size();
+        for (const auto & cs : speed) {
+            if (alike || cs.second > slowest) {
+                topo.perf.push_back(cs.first);
+            }
+        }
+    }
+#endif
+
+    if (topo.perf.empty()) {
+        topo.n_cpus = std::max(1, (int) std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < topo.n_cpus; ++cpu) {
+            topo.perf.push_back(cpu);
+        }
+    }
+
+    return topo;
+}
+
+static const whisper_cpu_topology & whisper_cpu_topology_get() {
+    static const whisper_cpu_topology topo = whisper_cpu_topology_probe();
+    return topo;
+}
+
+// the CPUs to pin compute threads to, empty when every CPU is a performance core and pinning would change nothing
+static std::vector<int> whisper_cpu_pinned(const whisper_context_params & params) {
+    const auto & topo = whisper_cpu_topology_get();
+
+    if (!params.use_perf_cores || (int) topo.perf.size() == topo.n_cpus) {
+        return {};
+    }
+
+    return topo.perf;
+}
+
+#if defined(__linux__)
+// raw syscalls, as in ggml: bionic has no pthread_setaffinity_np() and cpu_set_t needs _GNU_SOURCE
+typedef std::vector<unsigned long> whisper_cpu_mask;
+
+static const int WHISPER_CPU_MASK_BITS = 1024;
+static const int WHISPER_CPU_WORD_BITS = 8*sizeof(unsigned long);
+
+static bool whisper_cpu_mask_get(whisper_cpu_mask & mask) {
+    mask.assign(WHISPER_CPU_MASK_BITS/WHISPER_CPU_WORD_BITS, 0);
+    return syscall(SYS_sched_getaffinity, 0, mask.size()*sizeof(unsigned long), mask.data()) > 0;
+}
+
+static bool whisper_cpu_mask_set(const whisper_cpu_mask & mask) {
+    return syscall(SYS_sched_setaffinity, 0, mask.size()*sizeof(unsigned long), mask.data()) == 0;
+}
+
+static whisper_cpu_mask whisper_cpu_mask_from(const std::vector<int> & cpus) {
+    whisper_cpu_mask mask(WHISPER_CPU_MASK_BITS/WHISPER_CPU_WORD_BITS, 0);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < WHISPER_CPU_MASK_BITS) {
+            mask[cpu/WHISPER_CPU_WORD_BITS] |= 1UL << (cpu%WHISPER_CPU_WORD_BITS);
+        }
+    }
+    return mask;
+}
+#endif
+
+// Pins the calling thread to cpus (if any) and restores its previous affinity when it goes out of scope
+struct whisper_cpu_affinity_scope {
+#if defined(__linux__)
+    whisper_cpu_mask saved;
+    bool pinned = false;
+#endif
+
+    explicit whisper_cpu_affinity_scope(const std::vector<int> & cpus) {
+#if defined(__linux__)
+        if (!cpus.empty() && whisper_cpu_mask_get(saved)) {
+            pinned = whisper_cpu_mask_set(whisper_cpu_mask_from(cpus));
+        }
+#else
+        (void) cpus;
+#endif
+    }
+
+    ~whisper_cpu_affinity_scope() {
+#if defined(__linux__)
+        if (pinned) {
+            whisper_cpu_mask_set(saved);
+        }
+#endif
+    }
+
+    whisper_cpu_affinity_scope(const whisper_cpu_affinity_scope &) = delete;
+};
+
+// Worker threads that stay alive across calls, so that mel extraction and the per-token logit processing do not
+// create and join threads every time. Thread creation costs tens of microseconds on mobile and sampling runs once
+// per decoded token.
+// Not reentrant: a state is only used by one caller at a time.
+struct whisper_thread_pool {
+    std::mutex mutex;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+
+    std::vector<std::thread> workers;
+    std::vector<int>         cpus; // workers pin themselves to these when they start, empty for no restriction
+
+    const std::function<void(int)> * task = nullptr;
+    int      n_tasks    = 0;
+    int      n_pending  = 0; // tasks still running on the workers
+    uint64_t generation = 0; // bumped for every run()
+    bool     stop       = false;
+
+    whisper_thread_pool() = default;
+    whisper_thread_pool(const whisper_thread_pool &) = delete;
+
+    ~whisper_thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_work.notify_all();
+
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Calls fn(0) .. fn(n - 1) concurrently, fn(0) on the calling thread, and returns once all of them are done
+    void run(int n, const std::function<void(int)> & fn) {
+        if (n <= 1) {
+            fn(0);
+            return;
+        }
+
+        while ((int) workers.size() < n - 1) {
+            workers.emplace_back(&whisper_thread_pool::worker, this, (int) workers.size() + 1);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task      = &fn;
+            n_tasks   = n;
+            n_pending = n - 1;
+            generation++;
+        }
+        cv_work.notify_all();
+
+        fn(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [&] { return n_pending == 0; });
+        task = nullptr;
+    }
+
+    void worker(int ith) {
+        whisper_cpu_affinity_scope affinity(cpus);
+
+        uint64_t seen = 0;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cv_work.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) {
+                return;
+            }
+
+            seen = generation;
+            if (ith >= n_tasks) {
+                continue;
+            }
+
+            const auto * fn = task;
+
+            lock.unlock();
+            (*fn)(ith);
+            lock.lock();
+
+            if (--n_pending == 0) {
+                cv_done.notify_one();
+            }
+        }
+    }
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -781,6 +1293,8 @@ struct whisper_state {
     int32_t n_prompt = 0; // number of decoder calls with n_tokens >  1  (prompt encoding)
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
+    int32_t n_draft  = 0; // number of tokens proposed by the draft model
+    int32_t n_accept = 0; // number of draft tokens accepted by the model
 
     // unified self-attention KV cache for all decoders
     whisper_kv_cache kv_self;
@@ -841,6 +1355,91 @@ struct whisper_state {
 
     // [EXPERIMENTAL] speed-up techniques
     int32_t exp_n_audio_ctx = 0; // 0 - use default
+
+    // threads for mel extraction and logit processing, created on first use
+    whisper_thread_pool pool;
+
+    // logit filters for the current whisper_full() call
+    whisper_logits_mask logits_mask;
+};
+
+// read-only mapping of the model file
+// on the CPU backend, the weights are used directly from the mapping instead of being copied,
+// so loading only costs page faults and the pages are shared between contexts and processes
+struct whisper_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+    whisper_mmap(const whisper_mmap &) = delete;
+
+#if defined(_POSIX_MAPPED_FILES) && !defined(GGML_BIG_ENDIAN)
+    static constexpr bool SUPPORTED = true;
+
+    whisper_mmap(const char * path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void * ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr != MAP_FAILED) {
+                addr = ptr;
+                size = st.st_size;
+
+                // start reading ahead in the background, the first encoder pass touches most of the weights
+                if (posix_madvise(addr, size, POSIX_MADV_WILLNEED)) {
+                    WHISPER_LOG_WARN("%s: posix_madvise(.., POSIX_MADV_WILLNEED) failed: %s\n", __func__, strerror(errno));
+                }
+            }
+        }
+
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+    }
+
+    ~whisper_mmap() {
+        if (addr) {
+            munmap(addr, size);
+        }
+    }
+#else
+    static constexpr bool SUPPORTED = false;
+
+    whisper_mmap(const char * path) {
+        GGML_UNUSED(path);
+    }
+#endif
+};
+
+// whisper_model_loader context for reading the header, vocab and (non-mapped) tensors from a whisper_mmap
+struct whisper_mmap_reader {
+    const whisper_mmap * mapping;
+
+    size_t offs;
+};
+
+// Cross-attention K/V of recently encoded windows, keyed by a hash of the encoder input. Decoding the same audio
+// again (another prompt, grammar or temperature) restores them instead of running the encoder.
+// Shared by all states of a context, bounded by whisper_context_params.cross_cache_bytes.
+struct whisper_cross_cache {
+    struct entry {
+        uint64_t key;
+
+        // the hashed encoder input, compared on a hit so that a hash collision is a miss
+        std::vector<uint8_t> input;
+
+        // leading bytes of kv_cross.k and kv_cross.v, the part the window uses
+        std::vector<uint8_t> k;
+        std::vector<uint8_t> v;
+    };
+
+    std::mutex mutex;
+
+    std::list<entry> entries; // most recently used first
+
+    size_t size = 0; // bytes held by the entries
 };
 
 struct whisper_context {
@@ -860,6 +1459,16 @@ struct whisper_context {
     ggml_backend_t backend = nullptr;
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
+
+    std::unique_ptr<whisper_mmap> mapping; // set if tensor data points into the model file
+
+    // The text tokens as grammar candidates, decoded to code points from a clean UTF-8 state. Built on the first
+    // grammar-constrained decode and shared by all states; see whisper_grammar_vocab_candidates().
+    std::once_flag                         grammar_once;
+    std::vector<uint32_t>                  grammar_code_points;
+    std::vector<whisper_grammar_candidate> grammar_candidates;
+
+    whisper_cross_cache cross_cache;
 };
 
 struct whisper_global {
@@ -880,7 +1489,8 @@ static bool kv_cache_init(
         const struct whisper_hparams & hparams,
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                                  int   n_ctx) {
     const int64_t n_text_state = hparams.n_text_state;
     const int64_t n_text_layer = hparams.n_text_layer;
@@ -907,13 +1517,20 @@ static bool kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(cache.ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(cache.ctx, wtype, n_elements);
+    cache.k = ggml_new_tensor_1d(cache.ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(cache.ctx, type_v, n_elements);
 
     const size_t mem_bytes = ggml_nbytes(cache.k) + ggml_nbytes(cache.v);
 
     cache.buffer = ggml_backend_alloc_buffer(backend, mem_bytes);
 
+    if (!cache.buffer) {
+        WHISPER_LOG_ERROR("%s: failed to allocate memory for kv cache\n", __func__);
+        ggml_free(cache.ctx);
+        cache.ctx = nullptr;
+        return false;
+    }
+
     // allocate the tensors into the backend buffer
     {
         ggml_allocr * alloc = ggml_allocr_new_from_buffer(cache.buffer);
@@ -924,9 +1541,18 @@ static bool kv_cache_init(
         ggml_allocr_free(alloc);
     }
 
+    // unused cells are masked out of the attention, but 0*NaN would still poison it
+    ggml_backend_buffer_clear(cache.buffer, 0);
+
     return true;
 }
 
+// The cross-attention values are stored transposed, one row of n_audio_ctx per channel. Quantized rows are padded
+// with zeros to a whole number of blocks.
+static int whisper_kv_cross_n_ctx(const whisper_kv_cache & kv_cross, int n_audio_ctx) {
+    return GGML_PAD(n_audio_ctx, ggml_blck_size(kv_cross.v->type));
+}
+
 static void kv_cache_free(struct whisper_kv_cache & cache) {
     if (cache.ctx) {
         ggml_free(cache.ctx);
@@ -1088,33 +1714,130 @@ static ggml_backend_t whisper_backend_init(const whisper_context_params & params
     return ggml_backend_cpu_init();
 }
 
-// load the model from a ggml file
-//
-// file format:
-//
-//   - hparams
-//   - pre-computed mel filters
-//   - vocab
-//   - weights
-//
-// see the convert-pt-to-ggml.py script for details
-//
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
-    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+// find where the data of each tensor starts in a memory-mapped model file
+// the scan starts at the current reader offset, which must point at the first tensor header
+// only tensors that can be used in place are returned: known name, expected size and suitably aligned
+static std::map<std::string, size_t> whisper_mmap_scan_tensors(const whisper_mmap_reader & reader, const whisper_model & model) {
+    std::map<std::string, size_t> result;
 
-    const int64_t t_start_us = ggml_time_us();
+    const uint8_t * base = (const uint8_t *) reader.mapping->addr;
+    const size_t    size = reader.mapping->size;
 
-    wctx.t_start_us = t_start_us;
+    size_t offs = reader.offs;
 
-    auto & model = wctx.model;
-    auto & vocab = wctx.vocab;
+    while (offs + 3*sizeof(int32_t) <= size) {
+        int32_t n_dims;
+        int32_t length;
+        int32_t ttype;
 
-    // verify magic
-    {
-        uint32_t magic;
-        read_safe(loader, magic);
-        if (magic != GGML_FILE_MAGIC) {
-            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
+        memcpy(&n_dims, base + offs, sizeof(n_dims)); offs += sizeof(n_dims);
+        memcpy(&length, base + offs, sizeof(length)); offs += sizeof(length);
+        memcpy(&ttype,  base + offs, sizeof(ttype));  offs += sizeof(ttype);
+
+        if (n_dims < 1 || n_dims > 4 || length <= 0 || ttype < 0 || ttype >= GGML_TYPE_COUNT) {
+            break;
+        }
+
+        if (offs + n_dims*sizeof(int32_t) + length > size) {
+            break;
+        }
+
+        int64_t nelements = 1;
+        for (int i = 0; i < n_dims; ++i) {
+            int32_t ne;
+            memcpy(&ne, base + offs, sizeof(ne)); offs += sizeof(ne);
+            nelements *= ne;
+        }
+
+        const std::string name((const char *) base + offs, length);
+        offs += length;
+
+        const size_t nbytes = (nelements*ggml_type_size(ggml_type(ttype)))/ggml_blck_size(ggml_type(ttype));
+        if (offs + nbytes > size) {
+            break;
+        }
+
+        // the ggml file format does not pad tensor data, so the offset is arbitrary
+        // F32 data needs 4-byte alignment, F16 and the quantized blocks (fp16 scales) need 2 bytes
+        // 32-bit ARM can fault on unaligned VLDR/LDRD, so require 4 bytes for everything there
+#if defined(__arm__)
+        const size_t align = 4;
+#else
+        const size_t align = ttype == GGML_TYPE_F32 ? 4 : 2;
+#endif
+
+        const auto it = model.tensors.find(name);
+        if (it != model.tensors.end() && ggml_nbytes(it->second) == nbytes && (uintptr_t)(base + offs) % align == 0) {
+            result[name] = offs;
+        }
+
+        offs += nbytes;
+    }
+
+    return result;
+}
+
+// Each mel filter is a triangle over a handful of the n_fft bins. Keep only that span so the filterbank costs a few
+// hundred multiply-adds per frame instead of n_mel*n_fft.
+static void whisper_filters_init_sparse(whisper_filters & filters) {
+    filters.bin0  .resize(filters.n_mel);
+    filters.n_bins.resize(filters.n_mel);
+    filters.offset.resize(filters.n_mel);
+    filters.weights.clear();
+
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float * row = filters.data.data() + j*filters.n_fft;
+
+        int k0 = 0;
+        int k1 = 0;
+        for (int k = 0; k < filters.n_fft; k++) {
+            if (row[k] != 0.0f) {
+                if (k1 == 0) {
+                    k0 = k;
+                }
+                k1 = k + 1;
+            }
+        }
+
+        filters.bin0  [j] = k0;
+        filters.n_bins[j] = GGML_PAD(k1 - k0, 4);
+        filters.offset[j] = filters.weights.size();
+
+        filters.weights.insert(filters.weights.end(), row + k0, row + k1);
+        filters.weights.resize(filters.offset[j] + filters.n_bins[j], 0.0f);
+    }
+}
+
+// load the model from a ggml file
+//
+// file format:
+//
+//   - hparams
+//   - pre-computed mel filters
+//   - vocab
+//   - weights
+//
+// see the convert-pt-to-ggml.py script for details
+//
+// if mreader is set, the loader reads from a whisper_mmap and, on the CPU backend, the tensors found by
+// whisper_mmap_scan_tensors() keep pointing into the mapping instead of being copied
+//
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx, whisper_mmap_reader * mreader = nullptr) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    wctx.t_start_us = t_start_us;
+
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
+
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(loader, magic);
+        if (magic != GGML_FILE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
             return false;
         }
     }
@@ -1200,6 +1923,8 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         filters.data.resize(filters.n_mel * filters.n_fft);
         loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
         BYTESWAP_FILTERS(filters);
+
+        whisper_filters_init_sparse(filters);
     }
 
     // load vocab
@@ -1232,8 +1957,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 word = "";
             }
 
-            vocab.token_to_id[word] = i;
-            vocab.id_to_token[i] = word;
+            vocab.add(word);
 
             //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
         }
@@ -1283,11 +2007,12 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 } else {
                     word = "[_extra_token_" + std::to_string(i) + "]";
                 }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
+                vocab.add(word);
             }
         }
 
+        vocab.build_index();
+
         WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
     }
 
@@ -1514,10 +2239,34 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
     wctx.backend = whisper_backend_init(wctx.params);
 
+    // tensors whose data will be used directly from the memory-mapped file
+    std::map<std::string, size_t> mmap_offs;
+
+    if (mreader && ggml_backend_is_cpu(wctx.backend)) {
+        mmap_offs = whisper_mmap_scan_tensors(*mreader, model);
+
+        if (!mmap_offs.empty()) {
+            model.buffer_mmap = ggml_backend_cpu_buffer_from_ptr(mreader->mapping->addr, mreader->mapping->size);
+
+            size_t size_mmap = 0;
+
+            for (const auto & it : mmap_offs) {
+                auto tensor = model.tensors[it.first];
+                ggml_backend_tensor_alloc(model.buffer_mmap, tensor, (char *) mreader->mapping->addr + it.second);
+                size_mmap += ggml_nbytes(tensor);
+            }
+
+            WHISPER_LOG_INFO("%s: %8s buffer size = %8.2f MB (%zu of %zu tensors)\n", __func__, "mmap", size_mmap / 1e6, mmap_offs.size(), model.tensors.size());
+        }
+    }
+
     {
         size_t size_main = 0;
 
         for (const auto & t : model.tensors) {
+            if (mmap_offs.count(t.first)) {
+                continue;
+            }
             size_main += ggml_nbytes(t.second) + ggml_tensor_overhead();
         }
 
@@ -1531,6 +2280,9 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     // allocate tensors in the backend buffers
     {
         for (const auto & t : model.tensors) {
+            if (mmap_offs.count(t.first)) {
+                continue;
+            }
             ggml_allocr_alloc(alloc, t.second);
         }
     }
@@ -1600,7 +2352,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
             //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
 
-            if ((ggml_backend_is_cpu(backend)
+            if (model.buffer_mmap != nullptr && tensor->buffer == model.buffer_mmap) {
+                // the tensor already points into the mapped file - just skip over its data
+                mreader->offs += ggml_nbytes(tensor);
+            } else if ((ggml_backend_is_cpu(backend)
 #ifdef GGML_USE_METAL
                 || ggml_backend_is_metal(backend)
 #endif
@@ -2009,9 +2764,10 @@ static struct ggml_cgraph * whisper_build_graph_cross(
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
+    const int n_ctx     = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_ctx_pad = whisper_kv_cross_n_ctx(wstate.kv_cross, n_ctx);
+    const int n_state   = hparams.n_audio_state;
+    const int n_head    = hparams.n_audio_head;
 
     struct ggml_init_params params = {
         /*.mem_size   =*/ wstate.alloc_cross.meta.size(),
@@ -2054,13 +2810,18 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
         Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
+        if (ggml_is_quantized(wstate.kv_cross.v->type)) {
+            // rows are quantized whole
+            Vcross = ggml_pad(ctx0, ggml_cont(ctx0, Vcross), n_ctx_pad - n_ctx, 0, 0, 0);
+        }
+
         struct ggml_tensor * k = ggml_view_1d(ctx0, wstate.kv_cross.k,
                 n_state*n_ctx,
-                (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+                ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx));
 
-        struct ggml_tensor * v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
-                (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
-                (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
+        struct ggml_tensor * v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx_pad, n_state,
+                ggml_row_size(wstate.kv_cross.v->type, n_ctx_pad),
+                ggml_row_size(wstate.kv_cross.v->type, n_ctx_pad)*n_state*il);
 
         ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
         ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
@@ -2073,6 +2834,144 @@ static struct ggml_cgraph * whisper_build_graph_cross(
     return gf;
 }
 
+static void whisper_hash_update(uint64_t & h, const void * data, size_t n) {
+    const uint8_t * p = (const uint8_t *) data;
+
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+
+        h ^= w*0x9e3779b97f4a7c15ull;
+        h  = (h << 27 | h >> 37)*0xbf58476d1ce4e5b9ull;
+    }
+
+    for (; n > 0; --n, ++p) {
+        h = (h ^ *p)*0x100000001b3ull;
+    }
+}
+
+// everything the cross-attention K/V of a window depend on: the audio context, the cache types and the mel frames
+// the encoder reads (see whisper_build_graph_conv)
+static void whisper_cross_cache_input(
+      const whisper_context & wctx,
+        const whisper_state & wstate,
+                        int   mel_offset,
+       std::vector<uint8_t> & input) {
+    const auto & mel = wstate.mel;
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    const int i0 = std::min(mel_offset,           mel.n_len);
+    const int i1 = std::min(mel_offset + 2*n_ctx, mel.n_len);
+
+    const int32_t header[] = { n_ctx, i1 - i0, mel.n_mel, wstate.kv_cross.k->type, wstate.kv_cross.v->type };
+
+    const size_t n_row = (i1 - i0)*sizeof(float);
+
+    input.resize(sizeof(header) + mel.n_mel*n_row);
+
+    memcpy(input.data(), header, sizeof(header));
+    for (int j = 0; j < mel.n_mel; ++j) {
+        memcpy(input.data() + sizeof(header) + j*n_row, mel.data.data() + (size_t) j*mel.n_len + i0, n_row);
+    }
+}
+
+static uint64_t whisper_cross_cache_key(const std::vector<uint8_t> & input) {
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    whisper_hash_update(h, input.data(), input.size());
+
+    h ^= h >> 31;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 29;
+
+    return h;
+}
+
+// bytes of kv_cross.k and kv_cross.v written by whisper_build_graph_cross() for the current audio context
+static void whisper_cross_cache_used(const whisper_context & wctx, const whisper_state & wstate, size_t & n_k, size_t & n_v) {
+    const auto & hparams = wctx.model.hparams;
+
+    const int n_ctx     = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_ctx_pad = whisper_kv_cross_n_ctx(wstate.kv_cross, n_ctx);
+
+    n_k = ggml_row_size(wstate.kv_cross.k->type, hparams.n_text_state)*n_ctx*hparams.n_text_layer;
+    n_v = ggml_row_size(wstate.kv_cross.v->type, n_ctx_pad)*hparams.n_text_state*hparams.n_text_layer;
+}
+
+static bool whisper_cross_cache_restore(
+            whisper_context & wctx,
+              whisper_state & wstate,
+                   uint64_t   key,
+ const std::vector<uint8_t> & input) {
+    auto & cache = wctx.cross_cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+        if (it->key != key || it->input != input) {
+            continue;
+        }
+
+        ggml_backend_tensor_set(wstate.kv_cross.k, it->k.data(), 0, it->k.size());
+        ggml_backend_tensor_set(wstate.kv_cross.v, it->v.data(), 0, it->v.size());
+
+        cache.entries.splice(cache.entries.begin(), cache.entries, it);
+
+        return true;
+    }
+
+    return false;
+}
+
+static void whisper_cross_cache_store(
+            whisper_context & wctx,
+        const whisper_state & wstate,
+                   uint64_t   key,
+       std::vector<uint8_t> && input) {
+    auto & cache = wctx.cross_cache;
+
+    const size_t size_max = wctx.params.cross_cache_bytes;
+
+    size_t n_k = 0;
+    size_t n_v = 0;
+    whisper_cross_cache_used(wctx, wstate, n_k, n_v);
+
+    const size_t n_entry = input.size() + n_k + n_v;
+
+    if (n_entry > size_max) {
+        return;
+    }
+
+    whisper_cross_cache::entry e;
+    e.key   = key;
+    e.input = std::move(input);
+    e.k.resize(n_k);
+    e.v.resize(n_v);
+
+    ggml_backend_tensor_get(wstate.kv_cross.k, e.k.data(), 0, n_k);
+    ggml_backend_tensor_get(wstate.kv_cross.v, e.v.data(), 0, n_v);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    // another state may have encoded the same window meanwhile
+    for (const auto & other : cache.entries) {
+        if (other.key == key && other.input == e.input) {
+            return;
+        }
+    }
+
+    while (!cache.entries.empty() && cache.size + n_entry > size_max) {
+        const auto & last = cache.entries.back();
+
+        cache.size -= last.input.size() + last.k.size() + last.v.size();
+        cache.entries.pop_back();
+    }
+
+    cache.entries.push_front(std::move(e));
+    cache.size += n_entry;
+}
+
 // evaluate the encoder with the given state
 //
 // given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
@@ -2092,6 +2991,21 @@ static bool whisper_encode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
+    const bool use_cross_cache = wctx.params.cross_cache_bytes > 0;
+
+    std::vector<uint8_t> input;
+    if (use_cross_cache) {
+        whisper_cross_cache_input(wctx, wstate, mel_offset, input);
+    }
+
+    const uint64_t key = use_cross_cache ? whisper_cross_cache_key(input) : 0;
+
+    if (use_cross_cache && whisper_cross_cache_restore(wctx, wstate, key, input)) {
+        wstate.t_encode_us += ggml_time_us() - t_start_us;
+
+        return !(abort_callback && abort_callback(abort_callback_data));
+    }
+
     // conv
     {
         auto & alloc = wstate.alloc_conv.alloc;
@@ -2139,6 +3053,10 @@ static bool whisper_encode_internal(
         }
     }
 
+    if (use_cross_cache) {
+        whisper_cross_cache_store(wctx, wstate, key, std::move(input));
+    }
+
     wstate.t_encode_us += ggml_time_us() - t_start_us;
     wstate.n_encode++;
 
@@ -2164,7 +3082,8 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     const int n_layer = hparams.n_text_layer;
 
     const int n_tokens    = batch.n_tokens;
-    const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_audio_ctx     = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_audio_ctx_pad = whisper_kv_cross_n_ctx(wstate.kv_cross, n_audio_ctx);
 
     const int32_t n_kv     = ggml_allocr_is_measure(alloc) ? n_ctx            : kv_self.n;
     const int32_t kv_head  = ggml_allocr_is_measure(alloc) ? n_ctx - n_tokens : kv_self.head;
@@ -2279,7 +3198,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
-                struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state, (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state, ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
                 struct ggml_tensor * v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
                         (   n_ctx)*ggml_element_size(kv_self.v),
                         (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
@@ -2298,9 +3217,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state/n_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state/n_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state/n_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             // K * Q
             struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
@@ -2370,9 +3289,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * Kcross =
                 ggml_view_3d(ctx0, wstate.kv_cross.k,
                         n_state/n_head, n_audio_ctx, n_head,
-                        ggml_element_size(wstate.kv_cross.k)*n_state,
-                        ggml_element_size(wstate.kv_cross.k)*n_state/n_head,
-                        ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                        ggml_row_size(wstate.kv_cross.k->type, n_state),
+                        ggml_row_size(wstate.kv_cross.k->type, n_state/n_head),
+                        ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
             //struct ggml_tensor * Vcross =
             //    ggml_reshape_3d(ctx0,
@@ -2386,10 +3305,10 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
             struct ggml_tensor * V =
                 ggml_view_3d(ctx0, wstate.kv_cross.v,
-                        n_audio_ctx, n_state/n_head, n_head,
-                        n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
-                        n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state/n_head,
-                        n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
+                        n_audio_ctx_pad, n_state/n_head, n_head,
+                        ggml_row_size(wstate.kv_cross.v->type, n_audio_ctx_pad),
+                        ggml_row_size(wstate.kv_cross.v->type, n_audio_ctx_pad)*n_state/n_head,
+                        ggml_row_size(wstate.kv_cross.v->type, n_audio_ctx_pad)*n_state*il);
 
             // ------
 
@@ -2412,6 +3331,11 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
             struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ);
 
+            if (n_audio_ctx_pad > n_audio_ctx) {
+                // zero weights for the padding of the quantized values
+                KQ_soft_max = ggml_pad(ctx0, KQ_soft_max, n_audio_ctx_pad - n_audio_ctx, 0, 0, 0);
+            }
+
             struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 
             struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
@@ -2504,6 +3428,120 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     return gf;
 }
 
+// measure the decoder graph, whose attention scales with the size of the self-attention cache
+static void whisper_allocr_decode_init(whisper_context & ctx, whisper_state & state) {
+    whisper_allocr_graph_init(state.alloc_decode, ctx.backend,
+            [&]() {
+                const auto & hparams = ctx.model.hparams;
+
+                // TODO: make sure this is the worst-case scenario
+                const int n_tokens = hparams.n_text_ctx;
+                const int n_past   = 0;
+
+                whisper_batch_prep_legacy(state.batch, nullptr, n_tokens, n_past, 0);
+
+                return whisper_build_graph_decoder(ctx, state, state.batch);
+            });
+}
+
+// Number of self-attention cache cells for n_decoders parallel sequences: the prompt, at most half of the text
+// context plus a few special tokens, is shared by all decoders, and each of them generates at most another half.
+// Capped by whisper_context_params.kv_self_max, but never below one full text context.
+static int whisper_kv_self_n_ctx(const whisper_context & ctx, int n_decoders) {
+    const int n_text_ctx = ctx.model.hparams.n_text_ctx;
+
+    const int n_max = ctx.params.kv_self_max > 0 ? ctx.params.kv_self_max : 3*n_text_ctx;
+
+    return std::max(n_text_ctx, std::min(n_max, (n_decoders + 1)*(n_text_ctx/2) + 8));
+}
+
+// reallocate the self-attention cache with n_ctx cells, keeping the contents of the cells that still fit
+// the new cache and decode buffer are allocated next to the old ones, which stay in place if that fails
+static bool whisper_kv_self_resize(whisper_context & ctx, whisper_state & state, int n_ctx) {
+    const auto & hparams = ctx.model.hparams;
+
+    auto & kv_self = state.kv_self;
+
+    if ((int) kv_self.size == n_ctx) {
+        return true;
+    }
+
+    const ggml_type type_k = kv_self.k->type;
+    const ggml_type type_v = kv_self.v->type;
+
+    whisper_kv_cache kv_new = {};
+
+    if (!kv_cache_init(hparams, kv_new, ctx.backend, type_k, type_v, n_ctx)) {
+        WHISPER_LOG_ERROR("%s: kv_cache_init() failed for self-attention cache\n", __func__);
+        return false;
+    }
+
+    const int n_old = kv_self.size;
+
+    int n_keep = 0;
+    for (int i = 0; i < std::min(n_old, n_ctx); ++i) {
+        if (kv_self.cells[i].pos >= 0) {
+            n_keep = i + 1;
+        }
+    }
+
+    if (n_keep > 0) {
+        const int n_state = hparams.n_text_state;
+        const int n_layer = hparams.n_text_layer;
+
+        std::vector<uint8_t> k_old(ggml_nbytes(kv_self.k));
+        std::vector<uint8_t> v_old(ggml_nbytes(kv_self.v));
+
+        ggml_backend_tensor_get(kv_self.k, k_old.data(), 0, k_old.size());
+        ggml_backend_tensor_get(kv_self.v, v_old.data(), 0, v_old.size());
+
+        // K holds a row per cell and layer, V (transposed) a row of cells per channel and layer
+        const size_t row_k = ggml_row_size(type_k, n_state);
+        const size_t esz_v = ggml_element_size(kv_self.v);
+
+        std::vector<uint8_t> k_new(ggml_nbytes(kv_new.k));
+        std::vector<uint8_t> v_new(ggml_nbytes(kv_new.v));
+
+        for (int il = 0; il < n_layer; ++il) {
+            memcpy(k_new.data() + row_k*n_ctx*il, k_old.data() + row_k*n_old*il, row_k*n_keep);
+        }
+        for (int r = 0; r < n_layer*n_state; ++r) {
+            memcpy(v_new.data() + esz_v*n_ctx*r, v_old.data() + esz_v*n_old*r, esz_v*n_keep);
+        }
+
+        ggml_backend_tensor_set(kv_new.k, k_new.data(), 0, k_new.size());
+        ggml_backend_tensor_set(kv_new.v, v_new.data(), 0, v_new.size());
+
+        std::copy(kv_self.cells.begin(), kv_self.cells.begin() + n_keep, kv_new.cells.begin());
+    }
+
+    // the decoder graph is measured against state.kv_self
+    std::swap(kv_self, kv_new);
+
+    whisper_allocr alloc_old = std::move(state.alloc_decode);
+    state.alloc_decode = {};
+
+    whisper_allocr_decode_init(ctx, state);
+
+    if (!whisper_allocr_graph_realloc(state.alloc_decode, ctx.backend)) {
+        whisper_allocr_free(state.alloc_decode);
+        state.alloc_decode = std::move(alloc_old);
+
+        std::swap(kv_self, kv_new);
+        kv_cache_free(kv_new);
+
+        return false;
+    }
+
+    whisper_allocr_free(alloc_old);
+    kv_cache_free(kv_new);
+
+    WHISPER_LOG_DEBUG("%s: kv self size = %d cells, %7.2f MB, compute buffer (decode) = %7.2f MB\n", __func__, n_ctx,
+            (ggml_nbytes(kv_self.k) + ggml_nbytes(kv_self.v))/1e6, whisper_allocr_size(state.alloc_decode)/1e6);
+
+    return true;
+}
+
 // evaluate the decoder
 //
 // given text prompt + audio features -> computes the logits for the next token
@@ -2541,8 +3579,9 @@ static bool whisper_decode_internal(
             return false;
         }
 
-        kv_self.n = whisper_kv_cache_cell_max(kv_self);
-        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
+        // a whole number of SIMD steps (at most 32 elements), so the masked cells of a batch only add exact zeros to the
+        // dot products of KQV and a token gets the same logits whether it is decoded alone or in a batch
+        kv_self.n = std::min((int32_t) kv_self.size, GGML_PAD(whisper_kv_cache_cell_max(kv_self), 32));
         //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
     }
 
@@ -2611,104 +3650,398 @@ static std::string to_timestamp(int64_t t, bool comma = false) {
     return std::string(buf);
 }
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
-static float sin_vals[SIN_COS_N_COUNT];
-static float cos_vals[SIN_COS_N_COUNT];
+//
+// FFT for the mel spectrogram
+//
+// Iterative mixed-radix Stockham FFT on split real/imaginary arrays: no recursion, no bit-reversal pass and no
+// allocations per frame. A real frame of even length N is packed into a complex sequence of length N/2, transformed
+// and then split into the N/2 + 1 bins of the real spectrum. For N = 400 the complex length is 200 = 4*2*5*5.
+//
+// Radices 2, 3, 4 and 5 have dedicated butterflies, other primes fall back to an O(p^2) one. Stages whose stride is a
+// multiple of 4 run 4 transforms at a time with NEON or SSE.
+//
+
+struct whisper_fft_stage {
+    int radix;
+    int n; // sub-transform length at this stage
+    int s; // stride: product of the radices of the previous stages
+
+    size_t i_tw; // (radix - 1)*(n/radix) twiddles in whisper_fft_plan::tw_re/tw_im, [p][j - 1] = exp(-2*pi*i*j*p/n)
+    size_t i_rw; // radix roots of unity, only used by the generic butterfly
+};
+
+struct whisper_fft_plan {
+    int n   = 0; // real input length
+    int n_c = 0; // complex transform length, n/2
+
+    std::vector<whisper_fft_stage> stages;
+
+    std::vector<float> tw_re;
+    std::vector<float> tw_im;
+
+    // exp(-2*pi*i*k/n) for k in [0, n/2], used to split the packed transform
+    std::vector<float> rtw_re;
+    std::vector<float> rtw_im;
+};
 
-// In FFT, we frequently use sine and cosine operations with the same values.
-// We can use precalculated values to speed up the process.
-static void fill_sin_cos_table() {
-    static bool is_filled = false;
-    if (is_filled) return;
-    for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-        double theta = (2*M_PI*i)/SIN_COS_N_COUNT;
-        sin_vals[i] = sinf(theta);
-        cos_vals[i] = cosf(theta);
+// Per-thread work buffers: two ping-pong buffers of n_c complex values
+struct whisper_fft_work {
+    std::vector<float> buf;
+
+    void init(const whisper_fft_plan & plan) {
+        buf.resize(4*plan.n_c);
     }
-    is_filled = true;
-}
+};
+
+static whisper_fft_plan whisper_fft_plan_init(int n) {
+    GGML_ASSERT(n >= 2 && n % 2 == 0);
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const std::vector<float> & in, std::vector<float> & out) {
-    int N = in.size();
+    whisper_fft_plan plan;
+    plan.n   = n;
+    plan.n_c = n/2;
+
+    // largest radices first: radix-4 butterflies are the cheapest per point
+    std::vector<int> radices;
+    {
+        int rem = plan.n_c;
+        for (int r : { 4, 2, 3, 5 }) {
+            while (rem % r == 0) {
+                radices.push_back(r);
+                rem /= r;
+            }
+        }
+        for (int r = 7; rem > 1; r += 2) {
+            while (rem % r == 0) {
+                radices.push_back(r);
+                rem /= r;
+            }
+        }
+    }
 
-    out.resize(N*2);
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+    int len = plan.n_c;
+    int s   = 1;
+    for (int r : radices) {
+        whisper_fft_stage st;
+        st.radix = r;
+        st.n     = len;
+        st.s     = s;
+        st.i_tw  = plan.tw_re.size();
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+        const int m = len/r;
+        for (int p = 0; p < m; p++) {
+            for (int j = 1; j < r; j++) {
+                const double theta = (2.0*M_PI*j*p)/len;
+                plan.tw_re.push_back( cos(theta));
+                plan.tw_im.push_back(-sin(theta));
+            }
+        }
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*cos_vals[idx]; // cos(t)
-            im -= in[n]*sin_vals[idx]; // sin(t)
+        st.i_rw = plan.tw_re.size();
+        for (int j = 0; j < r; j++) {
+            const double theta = (2.0*M_PI*j)/r;
+            plan.tw_re.push_back( cos(theta));
+            plan.tw_im.push_back(-sin(theta));
         }
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
+        plan.stages.push_back(st);
+
+        len /= r;
+        s   *= r;
     }
+
+    plan.rtw_re.resize(plan.n_c + 1);
+    plan.rtw_im.resize(plan.n_c + 1);
+    for (int k = 0; k <= plan.n_c; k++) {
+        const double theta = (2.0*M_PI*k)/n;
+        plan.rtw_re[k] =  cos(theta);
+        plan.rtw_im[k] = -sin(theta);
+    }
+
+    return plan;
 }
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(const std::vector<float> & in, std::vector<float> & out) {
-    out.resize(in.size()*2);
+// Plans are built once per frame size and shared by all states
+static const whisper_fft_plan & whisper_fft_plan_get(int n) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<whisper_fft_plan>> plans;
 
-    int N = in.size();
+    std::lock_guard<std::mutex> lock(mutex);
 
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
+    auto & plan = plans[n];
+    if (!plan) {
+        plan.reset(new whisper_fft_plan(whisper_fft_plan_init(n)));
     }
 
-    if (N%2 == 1) {
-        dft(in, out);
-        return;
-    }
+    return *plan;
+}
 
-    std::vector<float> even;
-    std::vector<float> odd;
+// The butterflies are written once against this interface and instantiated for
+// float (1 lane) and, where available, for a 4-lane SIMD vector
+template <typename T>
+struct whisper_fft_vec;
 
-    even.reserve(N/2);
-    odd.reserve(N/2);
+template <>
+struct whisper_fft_vec<float> {
+    static constexpr int width = 1;
 
-    for (int i = 0; i < N; i++) {
-        if (i % 2 == 0) {
-            even.push_back(in[i]);
-        } else {
-            odd.push_back(in[i]);
+    static float load (const float * p)     { return *p; }
+    static void  store(float * p, float v)  { *p = v; }
+    static float set1 (float v)             { return v; }
+};
+
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define WHISPER_FFT_SIMD
+
+#if defined(__ARM_NEON)
+struct whisper_f32x4 { float32x4_t v; };
+
+static inline whisper_f32x4 operator+(whisper_f32x4 a, whisper_f32x4 b) { return { vaddq_f32(a.v, b.v) }; }
+static inline whisper_f32x4 operator-(whisper_f32x4 a, whisper_f32x4 b) { return { vsubq_f32(a.v, b.v) }; }
+static inline whisper_f32x4 operator*(whisper_f32x4 a, whisper_f32x4 b) { return { vmulq_f32(a.v, b.v) }; }
+
+template <>
+struct whisper_fft_vec<whisper_f32x4> {
+    static constexpr int width = 4;
+
+    static whisper_f32x4 load (const float * p)            { return { vld1q_f32(p) }; }
+    static void          store(float * p, whisper_f32x4 v) { vst1q_f32(p, v.v); }
+    static whisper_f32x4 set1 (float v)                    { return { vdupq_n_f32(v) }; }
+};
+#else
+struct whisper_f32x4 { __m128 v; };
+
+static inline whisper_f32x4 operator+(whisper_f32x4 a, whisper_f32x4 b) { return { _mm_add_ps(a.v, b.v) }; }
+static inline whisper_f32x4 operator-(whisper_f32x4 a, whisper_f32x4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+static inline whisper_f32x4 operator*(whisper_f32x4 a, whisper_f32x4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+template <>
+struct whisper_fft_vec<whisper_f32x4> {
+    static constexpr int width = 4;
+
+    static whisper_f32x4 load (const float * p)            { return { _mm_loadu_ps(p) }; }
+    static void          store(float * p, whisper_f32x4 v) { _mm_storeu_ps(p, v.v); }
+    static whisper_f32x4 set1 (float v)                    { return { _mm_set1_ps(v) }; }
+};
+#endif
+#endif
+
+// One Stockham pass for the transforms q in [q0, q1):
+//   a_k = x[q + s*(p + k*m)], y[q + s*(r*p + j)] = exp(-2*pi*i*j*p/n) * sum_k a_k*exp(-2*pi*i*j*k/r)
+template <typename T>
+static void whisper_fft_pass(
+        const whisper_fft_plan & plan,
+        const whisper_fft_stage & st,
+        const float * xr, const float * xi,
+              float * yr,       float * yi,
+        int q0, int q1) {
+    using V = whisper_fft_vec<T>;
+
+    const int r = st.radix;
+    const int s = st.s;
+    const int m = st.n/r;
+
+    const float * twr = plan.tw_re.data() + st.i_tw;
+    const float * twi = plan.tw_im.data() + st.i_tw;
+
+    // y_j = a*w
+    auto store_tw = [&](int i, T re, T im, int p, int j) {
+        if (j == 0) {
+            V::store(yr + i, re);
+            V::store(yi + i, im);
+            return;
+        }
+        const T wr = V::set1(twr[p*(r - 1) + j - 1]);
+        const T wi = V::set1(twi[p*(r - 1) + j - 1]);
+        V::store(yr + i, re*wr - im*wi);
+        V::store(yi + i, re*wi + im*wr);
+    };
+
+    for (int p = 0; p < m; p++) {
+        const int i_in  = s*p;
+        const int i_out = s*r*p;
+
+        for (int q = q0; q < q1; q += V::width) {
+            const int ix = i_in  + q;
+            const int iy = i_out + q;
+
+            switch (r) {
+                case 2:
+                    {
+                        const T a0r = V::load(xr + ix),       a0i = V::load(xi + ix);
+                        const T a1r = V::load(xr + ix + s*m), a1i = V::load(xi + ix + s*m);
+
+                        store_tw(iy,     a0r + a1r, a0i + a1i, p, 0);
+                        store_tw(iy + s, a0r - a1r, a0i - a1i, p, 1);
+                    } break;
+                case 3:
+                    {
+                        const T c = V::set1(0.86602540378443864676f); // sin(2*pi/3)
+                        const T h = V::set1(0.5f);
+
+                        const T a0r = V::load(xr + ix),         a0i = V::load(xi + ix);
+                        const T a1r = V::load(xr + ix + s*m),   a1i = V::load(xi + ix + s*m);
+                        const T a2r = V::load(xr + ix + 2*s*m), a2i = V::load(xi + ix + 2*s*m);
+
+                        const T tr = a1r + a2r, ti = a1i + a2i;
+                        const T mr = a0r - h*tr, mi = a0i - h*ti;
+                        const T dr = c*(a1r - a2r), di = c*(a1i - a2i);
+
+                        store_tw(iy,       a0r + tr, a0i + ti, p, 0);
+                        store_tw(iy + s,   mr + di,  mi - dr,  p, 1);
+                        store_tw(iy + 2*s, mr - di,  mi + dr,  p, 2);
+                    } break;
+                case 4:
+                    {
+                        const T a0r = V::load(xr + ix),         a0i = V::load(xi + ix);
+                        const T a1r = V::load(xr + ix + s*m),   a1i = V::load(xi + ix + s*m);
+                        const T a2r = V::load(xr + ix + 2*s*m), a2i = V::load(xi + ix + 2*s*m);
+                        const T a3r = V::load(xr + ix + 3*s*m), a3i = V::load(xi + ix + 3*s*m);
+
+                        const T t0r = a0r + a2r, t0i = a0i + a2i;
+                        const T t1r = a0r - a2r, t1i = a0i - a2i;
+                        const T t2r = a1r + a3r, t2i = a1i + a3i;
+                        const T t3r = a1r - a3r, t3i = a1i - a3i;
+
+                        store_tw(iy,       t0r + t2r, t0i + t2i, p, 0);
+                        store_tw(iy + s,   t1r + t3i, t1i - t3r, p, 1);
+                        store_tw(iy + 2*s, t0r - t2r, t0i - t2i, p, 2);
+                        store_tw(iy + 3*s, t1r - t3i, t1i + t3r, p, 3);
+                    } break;
+                case 5:
+                    {
+                        const T c1 = V::set1( 0.30901699437494742410f); // cos(2*pi/5)
+                        const T c2 = V::set1(-0.80901699437494742410f); // cos(4*pi/5)
+                        const T s1 = V::set1( 0.95105651629515357212f); // sin(2*pi/5)
+                        const T s2 = V::set1( 0.58778525229247312917f); // sin(4*pi/5)
+
+                        const T a0r = V::load(xr + ix),         a0i = V::load(xi + ix);
+                        const T a1r = V::load(xr + ix + s*m),   a1i = V::load(xi + ix + s*m);
+                        const T a2r = V::load(xr + ix + 2*s*m), a2i = V::load(xi + ix + 2*s*m);
+                        const T a3r = V::load(xr + ix + 3*s*m), a3i = V::load(xi + ix + 3*s*m);
+                        const T a4r = V::load(xr + ix + 4*s*m), a4i = V::load(xi + ix + 4*s*m);
+
+                        const T t1r = a1r + a4r, t1i = a1i + a4i;
+                        const T t2r = a2r + a3r, t2i = a2i + a3i;
+                        const T t3r = a1r - a4r, t3i = a1i - a4i;
+                        const T t4r = a2r - a3r, t4i = a2i - a3i;
+
+                        const T m1r = a0r + c1*t1r + c2*t2r, m1i = a0i + c1*t1i + c2*t2i;
+                        const T m2r = a0r + c2*t1r + c1*t2r, m2i = a0i + c2*t1i + c1*t2i;
+                        const T n1r = s1*t3r + s2*t4r,       n1i = s1*t3i + s2*t4i;
+                        const T n2r = s2*t3r - s1*t4r,       n2i = s2*t3i - s1*t4i;
+
+                        store_tw(iy,       a0r + t1r + t2r, a0i + t1i + t2i, p, 0);
+                        store_tw(iy + s,   m1r + n1i,       m1i - n1r,       p, 1);
+                        store_tw(iy + 2*s, m2r + n2i,       m2i - n2r,       p, 2);
+                        store_tw(iy + 3*s, m2r - n2i,       m2i + n2r,       p, 3);
+                        store_tw(iy + 4*s, m1r - n1i,       m1i + n1r,       p, 4);
+                    } break;
+                default:
+                    {
+                        const float * rwr = plan.tw_re.data() + st.i_rw;
+                        const float * rwi = plan.tw_im.data() + st.i_rw;
+
+                        for (int j = 0; j < r; j++) {
+                            T accr = V::set1(0.0f);
+                            T acci = V::set1(0.0f);
+                            for (int k = 0; k < r; k++) {
+                                const T wr = V::set1(rwr[(j*k) % r]);
+                                const T wi = V::set1(rwi[(j*k) % r]);
+                                const T ar = V::load(xr + ix + k*s*m);
+                                const T ai = V::load(xi + ix + k*s*m);
+                                accr = accr + ar*wr - ai*wi;
+                                acci = acci + ar*wi + ai*wr;
+                            }
+                            store_tw(iy + j*s, accr, acci, p, j);
+                        }
+                    } break;
+            }
         }
     }
+}
 
-    std::vector<float> even_fft;
-    std::vector<float> odd_fft;
+// Real FFT of plan.n samples. Writes the power |X[k]|^2 of the n/2 + 1 non-redundant bins to out.
+static void whisper_fft_power(
+        const whisper_fft_plan & plan,
+        whisper_fft_work & work,
+        const float * in,
+        float * out) {
+    const int n_c = plan.n_c;
 
-    fft(even, even_fft);
-    fft(odd, odd_fft);
+    float * xr = work.buf.data();
+    float * xi = xr + n_c;
+    float * yr = xi + n_c;
+    float * yi = yr + n_c;
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < N/2; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = cos_vals[idx]; // cos(t)
-        float im = -sin_vals[idx]; // sin(t)
+    // z[k] = in[2k] + i*in[2k + 1]
+    for (int k = 0; k < n_c; k++) {
+        xr[k] = in[2*k + 0];
+        xi[k] = in[2*k + 1];
+    }
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+    for (const auto & st : plan.stages) {
+        int q0 = 0;
+#if defined(WHISPER_FFT_SIMD)
+        q0 = st.s - st.s % 4;
+        whisper_fft_pass<whisper_f32x4>(plan, st, xr, xi, yr, yi, 0, q0);
+#endif
+        whisper_fft_pass<float>(plan, st, xr, xi, yr, yi, q0, st.s);
+
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+    }
+
+    // X[k] = (Z[k] + conj(Z[n_c - k]))/2 + exp(-2*pi*i*k/n)*(Z[k] - conj(Z[n_c - k]))/(2i)
+    for (int k = 0; k <= n_c; k++) {
+        const int k0 = k % n_c;
+        const int k1 = (n_c - k) % n_c;
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+        const float er =  0.5f*(xr[k0] + xr[k1]);
+        const float ei =  0.5f*(xi[k0] - xi[k1]);
+        const float dr =  0.5f*(xi[k0] + xi[k1]);
+        const float di = -0.5f*(xr[k0] - xr[k1]);
 
-        out[2*(k + N/2) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + N/2) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+        const float wr = plan.rtw_re[k];
+        const float wi = plan.rtw_im[k];
+
+        const float xkr = er + wr*dr - wi*di;
+        const float xki = ei + wr*di + wi*dr;
+
+        // Use pow(xkr, 2) + pow(xki, 2) causes inference quality problem? Interesting.
+        out[k] = xkr*xkr + xki*xki;
     }
 }
 
+// sum_i x[i]*w[i], n a multiple of 4
+static inline float whisper_dot_f32x4(const float * x, const float * w, int n) {
+#if defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int i = 0; i < n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(w + i));
+    }
+#if defined(__aarch64__)
+    return vaddvq_f32(acc);
+#else
+    const float32x2_t t = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(t, t), 0);
+#endif
+#elif defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(w + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < n; i += 4) {
+        sum += x[i + 0]*w[i + 0] + x[i + 1]*w[i + 1] + x[i + 2]*w[i + 2] + x[i + 3]*w[i + 3];
+    }
+    return sum;
+#endif
+}
+
 static bool hann_window(int length, bool periodic, std::vector<float> & output) {
     if (output.size() < static_cast<size_t>(length)) {
         output.resize(length);
@@ -2724,13 +4057,42 @@ static bool hann_window(int length, bool periodic, std::vector<float> & output)
     return true;
 }
 
+// One column of the log mel spectrogram from a windowed frame: FFT, power, sparse filterbank and log10.
+// fft_out needs the zero tail set up by the callers. Writes n_mel values, stride apart.
+static void log_mel_frame(
+        const whisper_fft_plan & fft_plan,
+        whisper_fft_work & fft_work,
+        const whisper_filters & filters,
+        const float * frame,
+        std::vector<float> & fft_out,
+        float * out,
+        int stride) {
+    // FFT + modulus^2 of the complex bins
+    whisper_fft_power(fft_plan, fft_work, frame, fft_out.data());
+
+    // sparse filterbank + log in one pass
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float sum = whisper_dot_f32x4(
+                fft_out.data() + filters.bin0[j], filters.weights.data() + filters.offset[j], filters.n_bins[j]);
+
+        out[j * stride] = log10f(std::max(sum, 1e-10f));
+    }
+}
+
+// fft_out sized for log_mel_frame
+static size_t log_mel_fft_out_size(int frame_size, const whisper_filters & filters) {
+    // zero tail: the padded filter spans may reach past the last bin
+    return GGML_PAD(std::max(1 + frame_size / 2, filters.n_fft), 4) + 4;
+}
+
 static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float> & hann, const std::vector<float> & samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
+                                              const whisper_filters & filters, const whisper_fft_plan & fft_plan,
+                                              whisper_mel & mel) {
     std::vector<float> fft_in(frame_size, 0.0);
-    std::vector<float> fft_out(2 * frame_step);
-    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    int n_fft = 1 + (frame_size / 2);
+    std::vector<float> fft_out(log_mel_fft_out_size(frame_size, filters), 0.0f);
+    whisper_fft_work fft_work;
+    fft_work.init(fft_plan);
     int i = ith;
 
     // calculate FFT only when fft_in are not all zero
@@ -2746,38 +4108,8 @@ static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float>
             std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
         }
 
-        // FFT
-        fft(fft_in, fft_out);
-
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < frame_size; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
-
         // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-
-            sum = log10(std::max(sum, 1e-10));
-
-            mel.data[j * mel.n_len + i] = sum;
-        }
+        log_mel_frame(fft_plan, fft_work, filters, fft_in.data(), fft_out, mel.data.data() + i, mel.n_len);
     }
 
     // Otherwise fft_out are all zero
@@ -2789,6 +4121,26 @@ static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float>
     }
 }
 
+// clamping and normalization
+static void log_mel_normalize(whisper_mel & mel) {
+    double mmax = -1e20;
+    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+        if (mel.data[i] > mmax) {
+            mmax = mel.data[i];
+        }
+    }
+
+    mmax -= 8.0;
+
+    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+        if (mel.data[i] < mmax) {
+            mel.data[i] = mmax;
+        }
+
+        mel.data[i] = (mel.data[i] + 4.0)/4.0;
+    }
+}
+
 // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
 static bool log_mel_spectrogram(
               whisper_state & wstate,
@@ -2810,6 +4162,7 @@ static bool log_mel_spectrogram(
     std::vector<float> hann;
     hann_window(frame_size, true, hann);
 
+    const whisper_fft_plan & fft_plan = whisper_fft_plan_get(frame_size);
 
     // Calculate the length of padding
     int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
@@ -2835,40 +4188,11 @@ static bool log_mel_spectrogram(
     mel.data.resize(mel.n_mel * mel.n_len);
 
 
-    {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, std::cref(hann), samples_padded,
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
-        }
-
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
-
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
-        }
-    }
-
-    // clamping and normalization
-    double mmax = -1e20;
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] > mmax) {
-            mmax = mel.data[i];
-        }
-    }
-
-    mmax -= 8.0;
-
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] < mmax) {
-            mel.data[i] = mmax;
-        }
+    wstate.pool.run(n_threads, [&](int ith) {
+        log_mel_spectrogram_worker_thread(ith, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, fft_plan, mel);
+    });
 
-        mel.data[i] = (mel.data[i] + 4.0)/4.0;
-    }
+    log_mel_normalize(mel);
 
     wstate.t_mel_us += ggml_time_us() - t_start_us;
 
@@ -2896,52 +4220,95 @@ static bool log_mel_spectrogram(
 // Regex (C++):
 // R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
 //
-static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
-    std::vector<std::string> words;
+// Splits text into the same words as the GPT-2 pre-tokenizer pattern
+//
+//   's|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+
+//
+// evaluated by std::regex (ECMAScript, "C" locale classes: bytes >= 0x80 are neither letters, digits nor space),
+// in one pass and without allocating. Calls fn(offset, length) for every word.
+template <typename F>
+static void whisper_pretokenize(const std::string & text, F && fn) {
+    enum { OTHER, ALPHA, DIGIT, SPACE };
+
+    const auto cls = [](char c) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) return ALPHA;
+        if (c >= '0' && c <= '9')                              return DIGIT;
+        if (c == ' ' || (c >= '\t' && c <= '\r'))              return SPACE;
+        return OTHER;
+    };
 
-    // first split the text into words
-    {
-        std::string str = text;
-        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
+    const char * s = text.data();
+    const int    n = (int) text.size();
+
+    int i = 0;
+    while (i < n) {
+        int len = 0;
+
+        // contractions
+        if (s[i] == '\'' && i + 1 < n) {
+            const char c1 = s[i + 1];
+            const char c2 = i + 2 < n ? s[i + 2] : 0;
+
+            if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') {
+                len = 2;
+            } else if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) {
+                len = 3;
+            }
+        }
 
-        std::regex re(pat);
-        std::smatch m;
+        if (len == 0) {
+            const int c = cls(s[i]);
 
-        while (std::regex_search(str, m, re)) {
-            for (auto x : m) {
-                words.push_back(x);
+            if (c != SPACE || (s[i] == ' ' && i + 1 < n && cls(s[i + 1]) != SPACE)) {
+                // a run of letters, digits or other characters, with an optional leading ' '
+                const int start = c == SPACE ? i + 1 : i;
+                const int run   = cls(s[start]);
+
+                int j = start + 1;
+                while (j < n && cls(s[j]) == run) {
+                    ++j;
+                }
+                len = j - i;
+            } else {
+                // whitespace: all of it at the end of the text, otherwise leave the last character to prefix the
+                // next word (\s+(?!\S)), unless that would leave nothing (\s+)
+                int j = i + 1;
+                while (j < n && cls(s[j]) == SPACE) {
+                    ++j;
+                }
+                len = j - i;
+                if (j < n && len > 1) {
+                    --len;
+                }
             }
-            str = m.suffix();
         }
+
+        fn(i, len);
+        i += len;
     }
+}
 
-    // find the longest tokens that form the words:
+static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
     std::vector<whisper_vocab::id> tokens;
-    for (const auto & word : words) {
-        if (word.empty()) continue;
+
+    // split the text into words and find the longest tokens that form them
+    whisper_pretokenize(text, [&](int offset, int len) {
+        const char * word = text.data() + offset;
 
         int i = 0;
-        int n = word.size();
-        while (i < n) {
-            int j = n;
-            bool found = false;
-            while (j > i) {
-                auto sub = word.substr(i, j-i);
-                auto it = vocab.token_to_id.find(sub);
-                if (it != vocab.token_to_id.end()) {
-                    tokens.push_back(it->second);
-                    i = j;
-                    found = true;
-                    break;
-                }
-                --j;
-            }
-            if (!found) {
+        while (i < len) {
+            whisper_vocab::id id = -1;
+
+            const int n = vocab.trie.longest_prefix(word + i, len - i, id);
+            if (n > 0) {
+                tokens.push_back(id);
+                i += n;
+            } else {
                 WHISPER_LOG_ERROR("unknown token\n");
                 ++i;
             }
         }
-    }
+    });
 
     return tokens;
 }
@@ -2999,17 +4366,29 @@ static std::string whisper_openvino_get_path_cache(std::string path_bin) {
 #endif
 
 struct whisper_state * whisper_init_state(whisper_context * ctx) {
-    fill_sin_cos_table();
-
     whisper_state * state = new whisper_state;
 
     state->backend = whisper_backend_init(ctx->params);
 
-    // at this point, we don't know yet how many decoders will be used, so we overallocate 3x ctx
-    // in theory, there can be a case where this is not enough, but in practice it should always be enough
-    const int factor = 3;
+    state->pool.cpus = whisper_cpu_pinned(ctx->params);
+    if (!state->pool.cpus.empty() && ggml_backend_is_cpu(state->backend)) {
+        ggml_backend_cpu_set_affinity(state->backend, state->pool.cpus.data(), (int) state->pool.cpus.size());
+    }
+
+    // the keys and the cross-attention values can be stored quantized, the self-attention values cannot since they are
+    // written one column at a time (see whisper_build_graph_decoder)
+    ggml_type kv_type = ctx->params.kv_type;
+    if (kv_type != GGML_TYPE_F16 && kv_type != GGML_TYPE_Q8_0 && kv_type != GGML_TYPE_Q4_0) {
+        WHISPER_LOG_WARN("%s: unsupported KV cache type %s, using %s\n", __func__, ggml_type_name(kv_type), ggml_type_name(ctx->itype));
+        kv_type = ctx->itype;
+    }
+    if (ggml_is_quantized(kv_type) && !ggml_backend_is_cpu(state->backend)) {
+        WHISPER_LOG_WARN("%s: quantized KV cache is only supported on the CPU backend, using %s\n", __func__, ggml_type_name(ctx->itype));
+        kv_type = ctx->itype;
+    }
 
-    if (!kv_cache_init(ctx->model.hparams, state->kv_self, ctx->backend, ctx->itype, factor*ctx->model.hparams.n_text_ctx)) {
+    // sized for a single decoder, whisper_full() resizes it for the number of decoders it runs
+    if (!kv_cache_init(ctx->model.hparams, state->kv_self, ctx->backend, kv_type, ctx->itype, whisper_kv_self_n_ctx(*ctx, 1))) {
         WHISPER_LOG_ERROR("%s: kv_cache_init() failed for self-attention cache\n", __func__);
         delete state;
         return nullptr;
@@ -3017,10 +4396,12 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB (K %s, V %s)\n", __func__, memory_size / 1e6,
+                ggml_type_name(state->kv_self.k->type), ggml_type_name(state->kv_self.v->type));
     }
 
-    if (!kv_cache_init(ctx->model.hparams, state->kv_cross, ctx->backend, ctx->itype, ctx->model.hparams.n_audio_ctx)) {
+    if (!kv_cache_init(ctx->model.hparams, state->kv_cross, ctx->backend, kv_type, kv_type,
+                GGML_PAD(ctx->model.hparams.n_audio_ctx, ggml_blck_size(kv_type)))) {
         WHISPER_LOG_ERROR("%s: kv_cache_init() failed for cross-attention cache\n", __func__);
         delete state;
         return nullptr;
@@ -3028,7 +4409,8 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
-        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB (K %s, V %s)\n", __func__, memory_size / 1e6,
+                ggml_type_name(state->kv_cross.k->type), ggml_type_name(state->kv_cross.v->type));
     }
 
 #ifdef WHISPER_USE_COREML
@@ -3095,26 +4477,18 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     // decoder allocator
     {
-        whisper_allocr_graph_init(state->alloc_decode, ctx->backend,
-                [&]() {
-                    const auto & hparams = ctx->model.hparams;
-
-                    // TODO: make sure this is the worst-case scenario
-                    const int n_tokens = hparams.n_text_ctx;
-                    const int n_past   = 0;
-
-                    whisper_batch_prep_legacy(state->batch, nullptr, n_tokens, n_past, 0);
-
-                    return whisper_build_graph_decoder(*ctx, *state, state->batch);
-                });
+        whisper_allocr_decode_init(*ctx, *state);
 
         WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_decode) / 1e6);
     }
 
-    whisper_allocr_graph_realloc(state->alloc_conv,   ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_encode, ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_cross,  ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_decode, ctx->backend);
+    if (!whisper_allocr_graph_realloc(state->alloc_conv,   ctx->backend) ||
+        !whisper_allocr_graph_realloc(state->alloc_encode, ctx->backend) ||
+        !whisper_allocr_graph_realloc(state->alloc_cross,  ctx->backend) ||
+        !whisper_allocr_graph_realloc(state->alloc_decode, ctx->backend)) {
+        whisper_free_state(state);
+        return nullptr;
+    }
 
     return state;
 }
@@ -3170,14 +4544,75 @@ int whisper_ctx_init_openvino_encoder(
 
 struct whisper_context_params whisper_context_default_params() {
     struct whisper_context_params result = {
-        /*.use_gpu    =*/ true,
+        /*.use_gpu           =*/ true,
+        /*.use_mmap          =*/ true,
+        /*.use_perf_cores    =*/ true,
+        /*.kv_type           =*/ GGML_TYPE_F16,
+        /*.kv_self_max       =*/ 0,
+        /*.cross_cache_bytes =*/ 0,
     };
     return result;
 }
 
+static whisper_context * whisper_init_with_params_no_state_internal(struct whisper_model_loader * loader, struct whisper_context_params params, whisper_mmap_reader * mreader);
+
+static struct whisper_context * whisper_init_from_mmap_with_params_no_state(const char * path_model, struct whisper_context_params params) {
+    std::unique_ptr<whisper_mmap> mapping(new whisper_mmap(path_model));
+    if (!mapping->addr) {
+        return nullptr;
+    }
+
+    whisper_mmap_reader reader = { mapping.get(), 0 };
+
+    whisper_model_loader loader = {};
+
+    loader.context = &reader;
+
+    loader.read = [](void * ctx, void * output, size_t read_size) {
+        whisper_mmap_reader * reader = (whisper_mmap_reader *) ctx;
+
+        const size_t size = reader->mapping->size;
+        const size_t size_to_copy = reader->offs + read_size < size ? read_size : size - reader->offs;
+
+        memcpy(output, (const char *) reader->mapping->addr + reader->offs, size_to_copy);
+        reader->offs += size_to_copy;
+
+        return size_to_copy;
+    };
+
+    loader.eof = [](void * ctx) {
+        whisper_mmap_reader * reader = (whisper_mmap_reader *) ctx;
+        return reader->offs >= reader->mapping->size;
+    };
+
+    loader.close = [](void * /*ctx*/) { };
+
+    auto ctx = whisper_init_with_params_no_state_internal(&loader, params, &reader);
+
+    if (ctx) {
+        ctx->path_model = path_model;
+
+        // keep the mapping alive only if tensors point into it
+        if (ctx->model.buffer_mmap) {
+            ctx->mapping = std::move(mapping);
+        }
+    }
+
+    return ctx;
+}
+
 struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
     WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
 
+    if (params.use_mmap && whisper_mmap::SUPPORTED) {
+        auto ctx = whisper_init_from_mmap_with_params_no_state(path_model, params);
+        if (ctx) {
+            return ctx;
+        }
+
+        WHISPER_LOG_WARN("%s: failed to load '%s' through mmap, falling back to reading it\n", __func__, path_model);
+    }
+
     auto fin = std::ifstream(path_model, std::ios::binary);
     if (!fin) {
         WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
@@ -3250,13 +4685,13 @@ struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * bu
     return whisper_init_with_params_no_state(&loader, params);
 }
 
-struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+static whisper_context * whisper_init_with_params_no_state_internal(struct whisper_model_loader * loader, struct whisper_context_params params, whisper_mmap_reader * mreader) {
     ggml_time_init();
 
     whisper_context * ctx = new whisper_context;
     ctx->params = params;
 
-    if (!whisper_model_load(loader, *ctx)) {
+    if (!whisper_model_load(loader, *ctx, mreader)) {
         loader->close(loader->context);
         WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
         delete ctx;
@@ -3268,6 +4703,10 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     return ctx;
 }
 
+struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    return whisper_init_with_params_no_state_internal(loader, params, nullptr);
+}
+
 struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
     whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
     if (!ctx) {
@@ -3380,6 +4819,10 @@ void whisper_free(struct whisper_context * ctx) {
             ggml_backend_buffer_free(ctx->model.buffer);
         }
 
+        if (ctx->model.buffer_mmap) {
+            ggml_backend_buffer_free(ctx->model.buffer_mmap);
+        }
+
         whisper_free_state(ctx->state);
 
         ggml_backend_free(ctx->backend);
@@ -3466,6 +4909,177 @@ int whisper_set_mel(
     return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
 }
 
+struct whisper_mel_stream {
+    // copy of the model's filters, so the stream outlives a reload of the model
+    whisper_filters filters;
+
+    const whisper_fft_plan * fft_plan = nullptr;
+    whisper_fft_work fft_work;
+
+    std::vector<float> hann;
+    std::vector<float> fft_in;
+    std::vector<float> fft_out;
+
+    // audio from stream position pcm_t0 on
+    std::vector<float> pcm;
+    int64_t pcm_t0   = 0;
+    int64_t n_pushed = 0;
+
+    // raw log10 columns (n_mel values each) of the frames [frame_f0, n_frames), centered at frame*WHISPER_HOP_LENGTH
+    std::vector<float> frames;
+    int64_t frame_f0 = 0;
+    int64_t n_frames = 0;
+};
+
+// Computes the column of frame f into out, treating the audio at and after t_end as zeros. The audio before the start
+// of the stream is reflected, as in log_mel_spectrogram.
+static void whisper_mel_stream_frame(whisper_mel_stream & ms, int64_t f, int64_t t_end, float * out) {
+    const int64_t t_begin = f*WHISPER_HOP_LENGTH - WHISPER_N_FFT/2;
+
+    for (int j = 0; j < WHISPER_N_FFT; j++) {
+        int64_t t = t_begin + j;
+        if (t < 0) {
+            t = -t;
+        }
+
+        const float x = t < t_end && t >= ms.pcm_t0 ? ms.pcm[t - ms.pcm_t0] : 0.0f;
+        ms.fft_in[j] = ms.hann[j]*x;
+    }
+
+    log_mel_frame(*ms.fft_plan, ms.fft_work, ms.filters, ms.fft_in.data(), ms.fft_out, out, 1);
+}
+
+struct whisper_mel_stream * whisper_mel_stream_init(struct whisper_context * ctx) {
+    whisper_mel_stream * ms = new whisper_mel_stream;
+
+    ms->filters  = ctx->model.filters;
+    ms->fft_plan = &whisper_fft_plan_get(WHISPER_N_FFT);
+    ms->fft_work.init(*ms->fft_plan);
+
+    hann_window(WHISPER_N_FFT, true, ms->hann);
+    ms->fft_in .resize(WHISPER_N_FFT);
+    ms->fft_out.resize(log_mel_fft_out_size(WHISPER_N_FFT, ms->filters), 0.0f);
+
+    return ms;
+}
+
+void whisper_mel_stream_free(struct whisper_mel_stream * ms) {
+    delete ms;
+}
+
+int64_t whisper_mel_stream_push(struct whisper_mel_stream * ms, const float * samples, int n_samples) {
+    if (n_samples <= 0) {
+        return ms->n_pushed;
+    }
+
+    ms->pcm.insert(ms->pcm.end(), samples, samples + n_samples);
+    ms->n_pushed += n_samples;
+
+    // frames whose window is now complete
+    const int n_mel = ms->filters.n_mel;
+    while (ms->n_frames*WHISPER_HOP_LENGTH + WHISPER_N_FFT/2 <= ms->n_pushed) {
+        const size_t i = ms->frames.size();
+        ms->frames.resize(i + n_mel);
+
+        whisper_mel_stream_frame(*ms, ms->n_frames, ms->n_pushed, ms->frames.data() + i);
+        ms->n_frames++;
+    }
+
+    return ms->n_pushed;
+}
+
+void whisper_mel_stream_discard(struct whisper_mel_stream * ms, int64_t t0) {
+    const int n_mel = ms->filters.n_mel;
+
+    // frames from the one at t0 on, and the audio they need
+    const int64_t f0 = std::min(t0/WHISPER_HOP_LENGTH, ms->n_frames);
+    if (f0 > ms->frame_f0) {
+        ms->frames.erase(ms->frames.begin(), ms->frames.begin() + (f0 - ms->frame_f0)*n_mel);
+        ms->frame_f0 = f0;
+    }
+
+    const int64_t pcm_t0 = std::min(std::max<int64_t>(0, f0*WHISPER_HOP_LENGTH - WHISPER_N_FFT/2), ms->n_pushed);
+    if (pcm_t0 > ms->pcm_t0) {
+        ms->pcm.erase(ms->pcm.begin(), ms->pcm.begin() + (pcm_t0 - ms->pcm_t0));
+        ms->pcm_t0 = pcm_t0;
+    }
+}
+
+int whisper_mel_stream_set_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+     struct whisper_mel_stream * ms,
+                       int64_t   t0,
+                       int64_t   t1) {
+    const int64_t t_start_us = ggml_time_us();
+
+    const int n_mel = ms->filters.n_mel;
+    if (n_mel != ctx->model.filters.n_mel) {
+        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
+        return -1;
+    }
+
+    t1 = std::min(t1, ms->n_pushed);
+    t0 = std::max(t0, ms->frame_f0*WHISPER_HOP_LENGTH);
+    t0 = t0 - t0 % WHISPER_HOP_LENGTH;
+    if (t0 >= t1) {
+        WHISPER_LOG_ERROR("%s: the window holds no audio\n", __func__);
+        return -2;
+    }
+
+    // same layout as log_mel_spectrogram() for the samples [t0, t1): followed by 30 s of silence
+    const int n_samples = t1 - t0;
+    const int stage_2_pad = WHISPER_N_FFT / 2;
+
+    auto & mel = state->mel;
+
+    mel.n_mel     = n_mel;
+    mel.n_len     = (n_samples + WHISPER_SAMPLE_RATE * 30) / WHISPER_HOP_LENGTH;
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - WHISPER_N_FFT) / WHISPER_HOP_LENGTH;
+    mel.data.resize(mel.n_mel * mel.n_len);
+
+    const int64_t f0 = t0 / WHISPER_HOP_LENGTH;
+    const int n_audio = std::min((n_samples + stage_2_pad) / WHISPER_HOP_LENGTH + 1, mel.n_len);
+
+    std::vector<float> column(n_mel);
+    for (int i = 0; i < n_audio; i++) {
+        const int64_t f = f0 + i;
+
+        const float * src = nullptr;
+        if (f < ms->n_frames && f*WHISPER_HOP_LENGTH + stage_2_pad <= t1) {
+            // cached: the frame lies within the window
+            src = ms->frames.data() + (f - ms->frame_f0)*n_mel;
+        } else {
+            // runs past the end of the window, zero padded like log_mel_spectrogram()
+            whisper_mel_stream_frame(*ms, f, t1, column.data());
+            src = column.data();
+        }
+
+        for (int j = 0; j < n_mel; j++) {
+            mel.data[j * mel.n_len + i] = src[j];
+        }
+    }
+
+    // silence
+    for (int j = 0; j < n_mel; j++) {
+        std::fill(mel.data.begin() + j * mel.n_len + n_audio, mel.data.begin() + (j + 1) * mel.n_len, log10f(1e-10f));
+    }
+
+    log_mel_normalize(mel);
+
+    state->t_mel_us += ggml_time_us() - t_start_us;
+
+    return 0;
+}
+
+int whisper_mel_stream_set(
+        struct whisper_context * ctx,
+     struct whisper_mel_stream * ms,
+                       int64_t   t0,
+                       int64_t   t1) {
+    return whisper_mel_stream_set_with_state(ctx, ctx->state, ms, t0, t1);
+}
+
 int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
     if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
         WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
@@ -3734,6 +5348,19 @@ int whisper_n_audio_ctx(struct whisper_context * ctx) {
     return ctx->model.hparams.n_audio_ctx;
 }
 
+int whisper_audio_ctx_for_samples(struct whisper_context * ctx, int n_samples) {
+    const int n_audio_ctx = ctx->model.hparams.n_audio_ctx;
+
+    // one encoder position per 2 mel frames
+    const int n_needed = (n_samples + 2*WHISPER_HOP_LENGTH - 1)/(2*WHISPER_HOP_LENGTH);
+
+    // margin: 25%, but at least 1 s (50 positions); padded to 64 positions for the matrix kernels
+    // below 128 positions (~2.5 s) the quality drops noticeably
+    const int n_ctx = std::max(128, GGML_PAD(n_needed + std::max(n_needed/4, 50), 64));
+
+    return n_ctx < n_audio_ctx ? n_ctx : 0;
+}
+
 int whisper_is_multilingual(struct whisper_context * ctx) {
     return ctx->vocab.is_multilingual() ? 1 : 0;
 }
@@ -3747,7 +5374,7 @@ float * whisper_get_logits_from_state(struct whisper_state * state) {
 }
 
 const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
+    return ctx->vocab.token_text(token);
 }
 
 whisper_token whisper_token_eot(struct whisper_context * ctx) {
@@ -3804,6 +5431,9 @@ void whisper_print_timings(struct whisper_context * ctx) {
         const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
 
         WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
+        if (ctx->state->n_draft > 0) {
+            WHISPER_LOG_INFO("%s:   draft tokens = %5d accepted / %5d\n", __func__, ctx->state->n_accept, ctx->state->n_draft);
+        }
         WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
         WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
         WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
@@ -3869,9 +5499,22 @@ const char * whisper_print_system_info(void) {
     s += "COREML = "    + std::to_string(whisper_has_coreml())     + " | ";
     s += "OPENVINO = "  + std::to_string(whisper_has_openvino())   + " | ";
 
+    const auto & topo = whisper_cpu_topology_get();
+    s += "PERF_CORES = " + std::to_string(topo.perf.size()) + "/" + std::to_string(topo.n_cpus) + " | ";
+
     return s.c_str();
 }
 
+int whisper_cpu_performance_cores(int * cpus, int n_max) {
+    const auto & perf = whisper_cpu_topology_get().perf;
+
+    for (int i = 0; i < n_max && i < (int) perf.size(); ++i) {
+        cpus[i] = perf[i];
+    }
+
+    return (int) perf.size();
+}
+
 //////////////////////////////////
 // Grammar - ported from llama.cpp
 //////////////////////////////////
@@ -4218,6 +5861,35 @@ static struct whisper_grammar whisper_grammar_init(
     return { std::move(vec_rules), std::move(stacks), {} };
 }
 
+// every text token (ids below eot, empty ones skipped) decoded from a clean UTF-8 state
+static const std::vector<whisper_grammar_candidate> & whisper_grammar_vocab_candidates(whisper_context & ctx) {
+    std::call_once(ctx.grammar_once, [&ctx]() {
+        const whisper_token eot = whisper_token_eot(&ctx);
+
+        std::vector<size_t> offsets;
+
+        for (whisper_token id = 0; id < eot; ++id) {
+            const char * text = ctx.vocab.token_text(id);
+            if (*text == 0) {
+                continue;
+            }
+
+            const auto decoded = decode_utf8(text, { 0, 0 });
+
+            offsets.push_back(ctx.grammar_code_points.size());
+            ctx.grammar_code_points.insert(ctx.grammar_code_points.end(), decoded.first.begin(), decoded.first.end());
+            ctx.grammar_candidates.push_back({ id, nullptr, decoded.second });
+        }
+
+        // the code points no longer move
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            ctx.grammar_candidates[i].code_points = ctx.grammar_code_points.data() + offsets[i];
+        }
+    });
+
+    return ctx.grammar_candidates;
+}
+
 static void whisper_suppress_invalid_grammar(
              whisper_context  & ctx,
     const whisper_full_params & params,
@@ -4238,13 +5910,27 @@ static void whisper_suppress_invalid_grammar(
 
     const whisper_token eot = whisper_token_eot(&ctx);
 
+    // decoding only depends on the previous state while it is in the middle of a multi-byte sequence
+    if (grammar.partial_utf8.n_remain <= 0) {
+        const auto rejects = whisper_grammar_reject_candidates(grammar.rules, grammar.stacks, whisper_grammar_vocab_candidates(ctx));
+
+        for (const auto & reject : rejects) {
+            logits[reject.id] -= params.grammar_penalty;
+        }
+
+        return;
+    }
+
     std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
     std::vector<whisper_grammar_candidate>                              candidates_grammar;
 
+    candidates_decoded.reserve(eot);
+    candidates_grammar.reserve(eot);
+
     for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
+        const char * text = ctx.vocab.token_text(id);
+        if (*text != 0) {
+            candidates_decoded.push_back(decode_utf8(text, grammar.partial_utf8));
             candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
         }
     }
@@ -4269,16 +5955,16 @@ static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar
 
     //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token[token].c_str());
 
-    const std::string & text = ctx.vocab.id_to_token[token];
+    const char * text = ctx.vocab.token_text(token);
 
-    if (text.rfind("[_", 0) == 0) {
+    if (strncmp(text, "[_", 2) == 0) {
         // fprintf(stderr, " (skipped)\n");
         return;
     }
     // fprintf(stderr, "\n");
 
     // Note terminating 0 in decoded string
-    const auto   decoded     = decode_utf8(text.c_str(), grammar.partial_utf8);
+    const auto   decoded     = decode_utf8(text, grammar.partial_utf8);
     const auto & code_points = decoded.first;
     for (auto it = code_points.begin(), end = code_points.end() - 1; it != end; ++it) {
         grammar.stacks = whisper_grammar_accept(grammar.rules, grammar.stacks, *it);
@@ -4312,7 +5998,7 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
     struct whisper_full_params result = {
         /*.strategy          =*/ strategy,
 
-        /*.n_threads         =*/ std::min(4, (int32_t) std::thread::hardware_concurrency()),
+        /*.n_threads         =*/ std::min(4, (int32_t) whisper_cpu_topology_get().perf.size()),
         /*.n_max_text_ctx    =*/ 16384,
         /*.offset_ms         =*/ 0,
         /*.duration_ms       =*/ 0,
@@ -4387,6 +6073,11 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.n_grammar_rules =*/ 0,
         /*.i_start_rule    =*/ 0,
         /*.grammar_penalty =*/ 100.0f,
+
+        /*.draft            =*/ {
+            /*.ctx     =*/ nullptr,
+            /*.n_draft =*/ 8,
+        },
     };
 
     switch (strategy) {
@@ -4486,10 +6177,76 @@ static const std::vector<std::string> non_speech_tokens = {
     "♪♪♪","♩", "♪", "♫", "♬", "♭", "♮", "♯"
 };
 
+static void whisper_logits_mask_init(
+                 whisper_logits_mask & mask,
+              struct whisper_context & ctx,
+    const struct whisper_full_params & params) {
+    const auto & vocab = ctx.vocab;
+
+    mask.special.clear();
+    mask.non_speech.clear();
+    mask.blank.clear();
+
+    // suppress blank
+    // https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L388-L390
+    if (params.suppress_blank) {
+        mask.blank.push_back(vocab.token_eot);
+
+        const whisper_token space = vocab.find(" ");
+        if (space >= 0) {
+            mask.blank.push_back(space);
+        }
+    }
+
+    // suppress <|notimestamps|> token
+    // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L410-L412
+    mask.special.push_back(vocab.token_not);
+
+    // suppress sot and nosp tokens
+    mask.special.push_back(vocab.token_sot);
+    mask.special.push_back(vocab.token_nosp); // TODO: ignore this token for now
+
+    // [TDRZ] when tinydiarize is disabled, suppress solm token
+    if (params.tdrz_enable == false) {
+        mask.special.push_back(vocab.token_solm);
+    }
+
+    // suppress task tokens
+    mask.special.push_back(vocab.token_translate);
+    mask.special.push_back(vocab.token_transcribe);
+    mask.special.push_back(vocab.token_prev);
+
+    // suppress lang tokens
+    for (size_t i = 0; i < g_lang.size(); ++i) {
+        mask.special.push_back(whisper_token_lang(&ctx, i));
+    }
+
+    // suppress non-speech tokens
+    // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
+    if (params.suppress_non_speech_tokens) {
+        for (const std::string & token : non_speech_tokens) {
+            const std::string suppress_tokens[] = {token, " " + token};
+            for (const std::string & suppress_token : suppress_tokens) {
+                const whisper_token id = vocab.find(suppress_token);
+                if (id >= 0) {
+                    mask.non_speech.push_back(id);
+                }
+            }
+        }
+
+        // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
+        for (const char * token : { " -", " '" }) {
+            const whisper_token id = vocab.find(token);
+            if (id >= 0) {
+                mask.non_speech.push_back(id);
+            }
+        }
+    }
+}
+
 // process the logits for the selected decoder
 // - applies logit filters
 // - computes logprobs and probs
-// TODO: optimize
 static void whisper_process_logits(
               struct whisper_context & ctx,
                struct whisper_state  & state,
@@ -4500,96 +6257,57 @@ static void whisper_process_logits(
     const auto & tokens_cur = decoder.sequence.tokens;
 
     const bool is_initial = tokens_cur.size() == 0;
-    const int  n_logits   = vocab.id_to_token.size();
+    const int  n_logits   = vocab.size();
 
     WHISPER_ASSERT(n_logits == ctx.vocab.n_vocab);
 
+    // the token is picked straight from the logits, see whisper_sample_token()
+    const bool is_greedy = params.strategy == WHISPER_SAMPLING_GREEDY && temperature < 1e-6f;
+
     // extract the logits for the last token
     // we will be mutating, and therefore we don't want to use the ctx.logits buffer directly
     auto & probs    = decoder.probs;
     auto & logits   = decoder.logits;
     auto & logprobs = decoder.logprobs;
     {
+        const float * logits_src = state.logits.data() + decoder.i_batch*n_logits;
+
         logits.resize(n_logits);
-        memcpy(logits.data(), state.logits.data() + decoder.i_batch*n_logits, n_logits*sizeof(float));
 
         if (temperature > 0.0f) {
             for (int i = 0; i < n_logits; i++) {
-                logits[i] /= temperature;
+                logits[i] = logits_src[i]/temperature;
             }
+        } else {
+            memcpy(logits.data(), logits_src, n_logits*sizeof(float));
         }
-
-        // will be populated a bit later
-        probs.resize(n_logits);
-        logprobs.resize(n_logits);
     }
 
     // apply logit filters here
     // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L480-L493
     {
-        // suppress blank
-        // https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L388-L390
-        if (params.suppress_blank) {
-            if (is_initial) {
-                logits[vocab.token_eot]           = -INFINITY;
-                logits[vocab.token_to_id.at(" ")] = -INFINITY;
-            }
-        }
+        const auto & mask = state.logits_mask;
 
-        // suppress <|notimestamps|> token
-        // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L410-L412
-        logits[vocab.token_not] = -INFINITY;
-        if (params.no_timestamps) {
-            for (int i = vocab.token_beg; i < n_logits; ++i) {
-                logits[i] = -INFINITY;
+        if (is_initial) {
+            for (const whisper_token id : mask.blank) {
+                logits[id] = -INFINITY;
             }
         }
 
-        // suppress sot and nosp tokens
-        logits[vocab.token_sot]  = -INFINITY;
-        logits[vocab.token_nosp] = -INFINITY; // TODO: ignore this token for now
-
-        // [TDRZ] when tinydiarize is disabled, suppress solm token
-        if (params.tdrz_enable == false) {
-            logits[vocab.token_solm] = -INFINITY;
+        for (const whisper_token id : mask.special) {
+            logits[id] = -INFINITY;
         }
 
-        // suppress task tokens
-        logits[vocab.token_translate]  = -INFINITY;
-        logits[vocab.token_transcribe] = -INFINITY;
-        logits[vocab.token_prev]       = -INFINITY;
-
-        // suppress lang tokens
-        for (size_t i = 0; i < g_lang.size(); ++i) {
-            logits[whisper_token_lang(&ctx, i)] = -INFINITY;
+        if (params.no_timestamps) {
+            std::fill(logits.begin() + vocab.token_beg, logits.end(), -INFINITY);
         }
 
-        // suppress prev token
-        logits[vocab.token_prev] = -INFINITY;
-
         if (params.logits_filter_callback) {
             params.logits_filter_callback(&ctx, &state, tokens_cur.data(), tokens_cur.size(), logits.data(), params.logits_filter_callback_user_data);
         }
 
-        // suppress non-speech tokens
-        // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
-        if (params.suppress_non_speech_tokens) {
-            for (const std::string & token : non_speech_tokens) {
-                const std::string suppress_tokens[] = {token, " " + token};
-                for (const std::string & suppress_token : suppress_tokens) {
-                    if (vocab.token_to_id.find(suppress_token) != vocab.token_to_id.end()) {
-                        logits[vocab.token_to_id.at(suppress_token)] = -INFINITY;
-                    }
-                }
-            }
-
-            // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
-            if (vocab.token_to_id.find(" -") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" -")] = -INFINITY;
-            }
-            if (vocab.token_to_id.find(" '") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" '")] = -INFINITY;
-            }
+        for (const whisper_token id : mask.non_speech) {
+            logits[id] = -INFINITY;
         }
 
         // timestamps have to appear in pairs, except directly before EOT; mask logits accordingly
@@ -4634,88 +6352,94 @@ static void whisper_process_logits(
             }
         }
 
-        // populate the logprobs array (log_softmax)
+        // log_softmax denominator, split between text and timestamp tokens for the rule below
+        float logsumexp              = 0.0f;
+        float timestamp_logprob      = -INFINITY;
+        float max_text_token_logprob = -INFINITY;
         {
-            const float logit_max = *std::max_element(logits.begin(), logits.end());
-            float logsumexp = 0.0f;
-            for (int i = 0; i < n_logits; ++i) {
+            float max_text = -INFINITY;
+            float max_ts   = -INFINITY;
+
+            for (int i = 0; i < vocab.token_beg; ++i) {
+                max_text = std::max(max_text, logits[i]);
+            }
+            for (int i = vocab.token_beg; i < n_logits; ++i) {
+                max_ts = std::max(max_ts, logits[i]);
+            }
+
+            const float logit_max = std::max(max_text, max_ts);
+
+            float sum    = 0.0f;
+            float sum_ts = 0.0f;
+
+            for (int i = 0; i < vocab.token_beg; ++i) {
                 if (logits[i] > -INFINITY) {
-                    logsumexp += expf(logits[i] - logit_max);
+                    sum += expf(logits[i] - logit_max);
                 }
             }
-            logsumexp = logf(logsumexp) + logit_max;
-
-            for (int i = 0; i < n_logits; ++i) {
+            for (int i = vocab.token_beg; i < n_logits; ++i) {
                 if (logits[i] > -INFINITY) {
-                    logprobs[i] = logits[i] - logsumexp;
-                } else {
-                    logprobs[i] = -INFINITY;
+                    const float e = expf(logits[i] - logit_max);
+                    sum    += e;
+                    sum_ts += e;
                 }
             }
-        }
 
-        // if sum of probability over timestamps is above any other token, sample timestamp
-        // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L431-L437
-        {
+            logsumexp = logf(sum) + logit_max;
+
             // logsumexp over timestamps
-            float timestamp_logprob = -INFINITY;
-            {
-                float logsumexp = 0.0f;
-                const float logprob_max = *std::max_element(logprobs.begin() + vocab.token_beg, logprobs.end());
-                for (int i = vocab.token_beg; i < n_logits; ++i) {
-                    if (logprobs[i] > -INFINITY) {
-                        logsumexp += expf(logprobs[i] - logprob_max);
-                    }
-                }
-                if (logsumexp > 0.0f) {
-                    timestamp_logprob = logf(logsumexp) + logprob_max;
-                }
+            if (sum_ts > 0.0f) {
+                timestamp_logprob = logf(sum_ts) + logit_max - logsumexp;
             }
 
-            const float max_text_token_logprob = *std::max_element(logprobs.begin(), logprobs.begin() + vocab.token_beg);
+            max_text_token_logprob = max_text - logsumexp;
+        }
 
+        // if sum of probability over timestamps is above any other token, sample timestamp
+        // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L431-L437
+        {
             //WHISPER_LOG_INFO("timestamp_logprob=%f max_text_token_logprob=%f\n", timestamp_logprob, max_text_token_logprob);
 
             if (timestamp_logprob > max_text_token_logprob) {
+                // the timestamps keep their logprobs from before the text tokens were removed
                 for (int i = 0; i < vocab.token_beg; ++i) {
-                    logits[i]   = -INFINITY;
-                    logprobs[i] = -INFINITY;
+                    logits[i] = -INFINITY;
                 }
             } else {
                 if (params.n_grammar_rules > 0) {
                     whisper_suppress_invalid_grammar(ctx, params, logits, decoder.grammar);
 
-                    // populate the logprobs array (log_softmax)
-                    {
-                        const float logit_max = *std::max_element(logits.begin(), logits.end());
-                        float logsumexp = 0.0f;
-                        for (int i = 0; i < n_logits; ++i) {
-                            if (logits[i] > -INFINITY) {
-                                logsumexp += expf(logits[i] - logit_max);
-                            }
-                        }
-                        logsumexp = logf(logsumexp) + logit_max;
+                    const float logit_max = *std::max_element(logits.begin(), logits.end());
 
-                        for (int i = 0; i < n_logits; ++i) {
-                            if (logits[i] > -INFINITY) {
-                                logprobs[i] = logits[i] - logsumexp;
-                            } else {
-                                logprobs[i] = -INFINITY;
-                            }
+                    float sum = 0.0f;
+                    for (int i = 0; i < n_logits; ++i) {
+                        if (logits[i] > -INFINITY) {
+                            sum += expf(logits[i] - logit_max);
                         }
                     }
+
+                    logsumexp = logf(sum) + logit_max;
                 }
             }
         }
+
+        decoder.logsumexp = logsumexp;
     }
 
-    // compute probs
-    {
+    // populate the logprobs and probs arrays, which only sampling and beam search read
+    if (!is_greedy) {
+        probs.resize(n_logits);
+        logprobs.resize(n_logits);
+
+        const float logsumexp = decoder.logsumexp;
+
         for (int i = 0; i < n_logits; ++i) {
-            if (logits[i] == -INFINITY) {
-                probs[i] = 0.0f;
+            if (logits[i] > -INFINITY) {
+                logprobs[i] = logits[i] - logsumexp;
+                probs[i]    = expf(logprobs[i]);
             } else {
-                probs[i] = expf(logprobs[i]);
+                logprobs[i] = -INFINITY;
+                probs[i]    = 0.0f;
             }
         }
     }
@@ -4743,7 +6467,7 @@ static void whisper_process_logits(
         });
 
         for (int i = 0; i < 10; i++) {
-            const auto token   = vocab.id_to_token.at(pairs[i].second);
+            const auto token   = vocab.token_str(pairs[i].second);
             const auto prob    = pairs[i].first;
             const auto logit   = logits[pairs[i].second];
             const auto logprob = logprobs[pairs[i].second];
@@ -4774,6 +6498,40 @@ static void whisper_process_logits(
 #endif
 }
 
+// probability of the most likely timestamp token relative to all timestamps, the total probability of the
+// timestamps and the id of the most likely one (tid is left as is when every timestamp is suppressed)
+static void whisper_timestamp_probs(
+        const whisper_vocab   & vocab,
+        const whisper_decoder & decoder,
+                        float & pt,
+                        float & ptsum,
+                whisper_token & tid) {
+    const auto & logits = decoder.logits;
+
+    const int n_logits = vocab.n_vocab;
+
+    double sum_ts = 0.0;
+    double max_ts = 0.0;
+
+    for (int i = vocab.token_beg; i < n_logits; i++) {
+        if (!(logits[i] > -INFINITY)) {
+            continue;
+        }
+
+        const float logprob = logits[i] - decoder.logsumexp;
+        const float prob    = expf(logprob);
+
+        sum_ts += prob;
+        if (max_ts < prob) {
+            max_ts = prob;
+            tid = i;
+        }
+    }
+
+    pt    = max_ts/(sum_ts + 1e-10);
+    ptsum = sum_ts;
+}
+
 static whisper_token_data whisper_sample_token(
             whisper_context & ctx,
       const whisper_decoder & decoder,
@@ -4784,40 +6542,30 @@ static whisper_token_data whisper_sample_token(
 
     const auto & vocab = ctx.vocab;
 
-    const auto & probs    = decoder.probs;
-    const auto & logprobs = decoder.logprobs;
-
     const int n_logits = vocab.n_vocab;
 
-    {
-        double sum_ts = 0.0;
-        double max_ts = 0.0;
+    whisper_timestamp_probs(vocab, decoder, result.pt, result.ptsum, result.tid);
 
-        for (int i = vocab.token_beg; i < n_logits; i++) {
-            if (probs[i] == -INFINITY) {
-                continue;
-            }
+    if (best) {
+        // the most likely token has the largest logit, so only its own probability is needed
+        const auto & logits = decoder.logits;
 
-            sum_ts += probs[i];
-            if (max_ts < probs[i]) {
-                max_ts = probs[i];
-                result.tid = i;
+        float logit_max = -INFINITY;
+        for (int i = 0; i < n_logits; ++i) {
+            if (logit_max < logits[i]) {
+                logit_max = logits[i];
+                result.id = i;
             }
         }
 
-        result.pt    = max_ts/(sum_ts + 1e-10);
-        result.ptsum = sum_ts;
-    }
-
-    if (best) {
-        for (int i = 0; i < n_logits; ++i) {
-            if (result.p < probs[i]) {
-                result.id   = i;
-                result.p    = probs[i];
-                result.plog = logprobs[i];
-            }
+        if (logit_max > -INFINITY) {
+            result.plog = logit_max - decoder.logsumexp;
+            result.p    = expf(result.plog);
         }
     } else {
+        const auto & probs    = decoder.probs;
+        const auto & logprobs = decoder.logprobs;
+
         std::discrete_distribution<> dist(probs.begin(), probs.end());
 
         result.id   = dist(decoder.rng);
@@ -4840,29 +6588,8 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
     const auto & vocab = ctx.vocab;
 
     const auto & probs    = decoder.probs;
-    const auto & logits   = decoder.logits;
     const auto & logprobs = decoder.logprobs;
 
-    const int n_logits = vocab.n_vocab;
-
-    auto & logits_id = decoder.logits_id;
-
-    logits_id.resize(n_logits);
-    for (int i = 0; i < n_logits; ++i) {
-        logits_id[i].first = logits[i];
-        logits_id[i].second = i;
-    }
-
-    {
-        using pair_type = std::remove_reference<decltype(logits_id)>::type::value_type;
-        std::partial_sort(
-                logits_id.begin(),
-                logits_id.begin() + k, logits_id.end(),
-                [](const pair_type & a, const pair_type & b) {
-            return a.first > b.first;
-        });
-    }
-
     std::vector<whisper_token_data> result;
     result.reserve(k);
 
@@ -4871,25 +6598,7 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
     float pt    = 0.0;
     float ptsum = 0.0;
 
-    {
-        double sum_ts = 0.0;
-        double max_ts = 0.0;
-
-        for (int i = vocab.token_beg; i < n_logits; i++) {
-            if (probs[i] == -INFINITY) {
-                continue;
-            }
-
-            sum_ts += probs[i];
-            if (max_ts < probs[i]) {
-                max_ts = probs[i];
-                tid = i;
-            }
-        }
-
-        pt    = max_ts/(sum_ts + 1e-10);
-        ptsum = sum_ts;
-    }
+    whisper_timestamp_probs(vocab, decoder, pt, ptsum, tid);
 
     std::discrete_distribution<> dist(probs.begin(), probs.end());
 
@@ -4957,12 +6666,77 @@ static void whisper_sequence_score(
     }
 }
 
+// Greedy continuation of tokens by the draft model: up to n_draft tokens, the last one may be the end of text.
+// The tokens that the model always suppresses are masked out. cached holds the tokens of the draft cache (sequence 0):
+// its cells are kept for the longest prefix shared with tokens, so only what was accepted since the previous call is
+// decoded again.
+static bool whisper_draft_tokens(
+                whisper_context & dctx,
+                  whisper_state & dstate,
+      const whisper_full_params & params,
+      const whisper_logits_mask & mask,
+const std::vector<whisper_token> & tokens,
+      std::vector<whisper_token> & cached,
+                            int   n_draft,
+      std::vector<whisper_token> & draft) {
+    const auto & vocab = dctx.vocab;
+
+    const int n_vocab = vocab.n_vocab;
+
+    draft.clear();
+
+    // the last token is always decoded again for its logits
+    size_t n_keep = 0;
+    while (n_keep < cached.size() && n_keep + 1 < tokens.size() && cached[n_keep] == tokens[n_keep]) {
+        ++n_keep;
+    }
+
+    whisper_kv_cache_seq_rm(dstate.kv_self, 0, n_keep, -1);
+    cached.assign(tokens.begin(), tokens.end());
+
+    whisper_batch_prep_legacy(dstate.batch, tokens.data() + n_keep, tokens.size() - n_keep, n_keep, 0);
+
+    while (true) {
+        if (!whisper_decode_internal(dctx, dstate, dstate.batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+            return false;
+        }
+
+        float * logits = dstate.logits.data() + (dstate.batch.n_tokens - 1)*n_vocab;
+
+        for (const auto id : mask.special) {
+            logits[id] = -INFINITY;
+        }
+        for (const auto id : mask.non_speech) {
+            logits[id] = -INFINITY;
+        }
+        if (params.no_timestamps) {
+            std::fill(logits + vocab.token_beg, logits + n_vocab, -INFINITY);
+        }
+
+        const whisper_token id = std::max_element(logits, logits + n_vocab) - logits;
+
+        draft.push_back(id);
+
+        if (id == vocab.token_eot || (int) draft.size() >= n_draft) {
+            break;
+        }
+
+        whisper_batch_prep_legacy(dstate.batch, &id, 1, cached.size(), 0);
+        cached.push_back(id);
+    }
+
+    return true;
+}
+
 int whisper_full_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
     struct whisper_full_params   params,
                    const float * samples,
                            int   n_samples) {
+    // worker 0 of every graph is this thread, keep it on the same cores as the others
+    whisper_cpu_affinity_scope affinity(state->pool.cpus);
+
     // clear old results
     auto & result_all = state->result_all;
 
@@ -5061,11 +6835,12 @@ int whisper_full_with_state(
         decoder.probs.resize   (ctx->vocab.n_vocab);
         decoder.logits.resize  (ctx->vocab.n_vocab);
         decoder.logprobs.resize(ctx->vocab.n_vocab);
-        decoder.logits_id.reserve(ctx->model.hparams.n_vocab);
 
         decoder.rng = std::mt19937(0);
     }
 
+    whisper_logits_mask_init(state->logits_mask, *ctx, params);
+
     // the accumulated text context so far
     auto & prompt_past = state->prompt_past;
     if (params.no_context) {
@@ -5101,6 +6876,32 @@ int whisper_full_with_state(
     }
     state->exp_n_audio_ctx = params.audio_ctx;
 
+    // speculative decoding: the draft model transcribes the same mel with its own encoder
+    whisper_context * dctx   = params.draft.n_draft > 0 ? params.draft.ctx : nullptr;
+    whisper_state   * dstate = dctx ? dctx->state : nullptr;
+
+    if (dctx != nullptr) {
+        const auto & dhparams = dctx->model.hparams;
+
+        if (dstate == nullptr || dstate == state) {
+            WHISPER_LOG_WARN("%s: the draft model needs a state of its own - speculative decoding disabled\n", __func__);
+            dctx = nullptr;
+        } else if (dhparams.n_vocab != ctx->model.hparams.n_vocab || dhparams.n_mels != ctx->model.hparams.n_mels) {
+            WHISPER_LOG_WARN("%s: the draft model does not match the vocabulary or the mel bins - speculative decoding disabled\n", __func__);
+            dctx = nullptr;
+        } else if (params.audio_ctx > dhparams.n_audio_ctx) {
+            WHISPER_LOG_WARN("%s: audio_ctx is larger than the draft model allows - speculative decoding disabled\n", __func__);
+            dctx = nullptr;
+        } else {
+            dstate->mel = state->mel;
+            dstate->exp_n_audio_ctx = params.audio_ctx;
+        }
+    }
+
+    // the window encoded by the draft model and the tokens its self-attention cache holds
+    int seek_draft = -1;
+    std::vector<whisper_token> draft_cached;
+
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
 
@@ -5181,6 +6982,10 @@ int whisper_full_with_state(
 
         int best_decoder_id = 0;
 
+        // the prompt whose KV cells (sequence 0) the self-attention cache holds for this window, and its logits
+        std::vector<whisper_token> prompt_kv;
+        std::vector<float>         prompt_logits;
+
         for (int it = 0; it < (int) temperatures.size(); ++it) {
             const float t_cur = temperatures[it];
 
@@ -5233,7 +7038,6 @@ int whisper_full_with_state(
             }
 
             // init prompt and kv cache for the current iteration
-            // TODO: do not recompute the prompt if it is the same as previous time
             {
                 prompt.clear();
 
@@ -5251,23 +7055,49 @@ int whisper_full_with_state(
                 // print the prompt
                 WHISPER_LOG_DEBUG("\n\n");
                 for (int i = 0; i < (int) prompt.size(); i++) {
-                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token.at(prompt[i]).c_str());
+                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.token_text(prompt[i]));
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
-                whisper_kv_cache_clear(state->kv_self);
+                const int n_vocab = ctx->vocab.n_vocab;
 
-                whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+                // Temperature fallbacks of a window usually share the prompt (only t >= 0.5 drops prompt_past), so
+                // the cells of the previous attempt are trimmed back to the prompt instead of decoding it again.
+                // All decoders hold the prompt cells, sequence 0 included even after beam search reordering.
+                const bool reuse_prompt = prompt == prompt_kv;
+
+                if (reuse_prompt) {
+                    whisper_kv_cache_seq_rm(state->kv_self, -1, prompt.size(), -1);
+                    for (int j = 1; j < WHISPER_MAX_DECODERS; ++j) {
+                        whisper_kv_cache_seq_rm(state->kv_self, j, -1, -1);
+                    }
+                } else {
+                    whisper_kv_cache_clear(state->kv_self);
+                }
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
-                    WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                // grow the cache for the fallback decoders, or give the memory back once they are done
+                if (!whisper_kv_self_resize(*ctx, *state, whisper_kv_self_n_ctx(*ctx, n_decoders_cur))) {
                     return -7;
                 }
 
+                if (reuse_prompt) {
+                    state->logits.assign(prompt_logits.begin(), prompt_logits.end());
+                } else {
+                    whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+                        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                        return -7;
+                    }
+
+                    prompt_kv = prompt;
+                    prompt_logits.assign(state->logits.begin() + (prompt.size() - 1)*n_vocab, state->logits.begin() + prompt.size()*n_vocab);
+                }
+
                 {
                     const int64_t t_start_sample_us = ggml_time_us();
 
-                    state->decoders[0].i_batch = prompt.size() - 1;
+                    state->decoders[0].i_batch = reuse_prompt ? 0 : prompt.size() - 1;
 
                     whisper_process_logits(*ctx, *state, state->decoders[0], params, t_cur);
 
@@ -5279,12 +7109,39 @@ int whisper_full_with_state(
                         memcpy(decoder.probs.data(),    state->decoders[0].probs.data(),    decoder.probs.size()*sizeof(decoder.probs[0]));
                         memcpy(decoder.logits.data(),   state->decoders[0].logits.data(),   decoder.logits.size()*sizeof(decoder.logits[0]));
                         memcpy(decoder.logprobs.data(), state->decoders[0].logprobs.data(), decoder.logprobs.size()*sizeof(decoder.logprobs[0]));
+
+                        decoder.logsumexp = state->decoders[0].logsumexp;
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
                 }
             }
 
+            // Greedy decoding at t = 0 picks the argmax of the logits, so the draft model may guess the next tokens:
+            // the model decodes them in one batch after the last sampled token, and every guess that matches the
+            // token sampled from the previous row already has its logits. On the CPU backend a row of the batch gets the
+            // same logits as a single-token decode (see kv_self.n in whisper_decode_internal), so the output is the same
+            // as without a draft - checked by tests/test-draft.cpp. GPU kernels may round a batch differently.
+            const bool speculative = dctx != nullptr && params.strategy == WHISPER_SAMPLING_GREEDY && n_decoders_cur == 1 && t_cur < 1e-6f;
+
+            std::vector<whisper_token> draft;       // tokens proposed after the last decoded one
+            size_t                     n_draft = 0; // of which the model has sampled so far
+
+            std::vector<whisper_token> tokens_ctx;  // prompt and sampled tokens, the context of the draft model
+
+            if (speculative && seek_draft != seek) {
+                if (!whisper_encode_internal(*dctx, *dstate, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+                    WHISPER_LOG_ERROR("%s: failed to encode with the draft model\n", __func__);
+                    return -6;
+                }
+
+                // the cells of the previous window attended to other audio
+                whisper_kv_cache_clear(dstate->kv_self);
+                draft_cached.clear();
+
+                seek_draft = seek;
+            }
+
             for (int i = 0, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
                 const int64_t t_start_sample_us = ggml_time_us();
 
@@ -5340,21 +7197,7 @@ int whisper_full_with_state(
 
                     const int n_threads = std::min(params.n_threads, n_decoders_cur);
 
-                    if (n_threads == 1) {
-                        process();
-                    } else {
-                        std::vector<std::thread> threads(n_threads - 1);
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t] = std::thread(process);
-                        }
-
-                        process();
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t].join();
-                        }
-                    }
+                    state->pool.run(n_threads, [&](int) { process(); });
                 }
 
                 beam_candidates.clear();
@@ -5402,7 +7245,7 @@ int whisper_full_with_state(
                         whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
 
                         WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                                __func__, j, cur.decoder_idx, ctx->vocab.token_text(decoder.sequence.tokens.back().id), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
                     }
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
@@ -5458,9 +7301,9 @@ int whisper_full_with_state(
 
 #ifdef WHISPER_DEBUG
                         {
-                            const auto tt = token.pt > 0.10 ? ctx->vocab.id_to_token.at(token.tid) : "[?]";
+                            const auto tt = token.pt > 0.10 ? ctx->vocab.token_str(token.tid) : "[?]";
                             WHISPER_LOG_DEBUG("%s: id = %3d, decoder = %d, token = %6d, p = %6.3f, ts = %10s, %6.3f, result_len = %4d '%s'\n",
-                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.id_to_token.at(token.id).c_str());
+                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.token_text(token.id));
                         }
 #endif
 
@@ -5535,28 +7378,73 @@ int whisper_full_with_state(
 
                     const int n_past = prompt.size() + i;
 
-                    for (int j = 0; j < n_decoders_cur; ++j) {
-                        auto & decoder = state->decoders[j];
+                    if (speculative) {
+                        auto & decoder = state->decoders[0];
 
-                        if (decoder.failed || decoder.completed) {
-                            continue;
+                        const whisper_token id = decoder.sequence.tokens.back().id;
+
+                        if (n_draft < draft.size() && draft[n_draft] == id) {
+                            // the row after the accepted token
+                            decoder.i_batch = ++n_draft;
+
+                            state->n_accept++;
+                        } else {
+                            // drop the cells of the rejected tokens
+                            whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+                            tokens_ctx.assign(prompt.begin(), prompt.end());
+                            for (const auto & token : decoder.sequence.tokens) {
+                                tokens_ctx.push_back(token.id);
+                            }
+
+                            // stay within the positional embeddings of both models
+                            const int n_draft_max = std::min(params.draft.n_draft, std::min(
+                                        whisper_n_text_ctx(ctx), whisper_n_text_ctx(dctx)) - 1 - n_past);
+
+                            draft.clear();
+                            if (n_draft_max > 0) {
+                                if (!whisper_draft_tokens(*dctx, *dstate, params, state->logits_mask, tokens_ctx, draft_cached, n_draft_max, draft)) {
+                                    WHISPER_LOG_ERROR("%s: failed to decode with the draft model\n", __func__);
+                                    return -8;
+                                }
+
+                                state->n_draft += draft.size();
+                            }
+
+                            n_draft = 0;
+
+                            whisper_batch_prep_legacy(batch, nullptr, 1 + draft.size(), n_past, 0);
+
+                            batch.token[0] = id;
+                            std::copy(draft.begin(), draft.end(), batch.token + 1);
+                            std::fill(batch.logits, batch.logits + batch.n_tokens, 1);
+
+                            decoder.i_batch = 0;
                         }
+                    } else {
+                        for (int j = 0; j < n_decoders_cur; ++j) {
+                            auto & decoder = state->decoders[j];
 
-                        //WHISPER_LOG_DEBUG("%s: decoder %d: token %d, seek_delta %d\n", __func__, j, decoder.sequence.tokens.back().id, decoder.seek_delta);
+                            if (decoder.failed || decoder.completed) {
+                                continue;
+                            }
 
-                        decoder.i_batch = batch.n_tokens;
+                            //WHISPER_LOG_DEBUG("%s: decoder %d: token %d, seek_delta %d\n", __func__, j, decoder.sequence.tokens.back().id, decoder.seek_delta);
 
-                        batch.token   [batch.n_tokens]    = decoder.sequence.tokens.back().id;
-                        batch.pos     [batch.n_tokens]    = n_past;
-                        batch.n_seq_id[batch.n_tokens]    = 1;
-                        batch.seq_id  [batch.n_tokens][0] = j;
-                        batch.logits  [batch.n_tokens]    = 1;
-                        batch.n_tokens++;
-                    }
+                            decoder.i_batch = batch.n_tokens;
 
-                    assert(batch.n_tokens > 0);
+                            batch.token   [batch.n_tokens]    = decoder.sequence.tokens.back().id;
+                            batch.pos     [batch.n_tokens]    = n_past;
+                            batch.n_seq_id[batch.n_tokens]    = 1;
+                            batch.seq_id  [batch.n_tokens][0] = j;
+                            batch.logits  [batch.n_tokens]    = 1;
+                            batch.n_tokens++;
+                        }
 
-                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+                        assert(batch.n_tokens > 0);
+                    }
+
+                    if (batch.n_tokens > 0 && !whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
                         WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                         return -8;
                     }
@@ -5587,21 +7475,7 @@ int whisper_full_with_state(
 
                         const int n_threads = std::min(params.n_threads, n_decoders_cur);
 
-                        if (n_threads == 1) {
-                            process();
-                        } else {
-                            std::vector<std::thread> threads(n_threads - 1);
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t] = std::thread(process);
-                            }
-
-                            process();
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t].join();
-                            }
-                        }
+                        state->pool.run(n_threads, [&](int) { process(); });
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
@@ -5661,7 +7535,7 @@ int whisper_full_with_state(
 
             if (success) {
                 //for (auto & token : ctx->decoders[best_decoder_id].sequence.tokens) {
-                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token.at(token.tid).c_str(), ctx->vocab.id_to_token.at(token.id).c_str());
+                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.token_text(token.tid), ctx->vocab.token_text(token.id));
                 //}
 
                 break;
@@ -5854,6 +7728,9 @@ int whisper_full_parallel(
         params_cur.progress_callback = nullptr;
         params_cur.progress_callback_user_data = nullptr;
 
+        // the draft state belongs to the calling thread
+        params_cur.draft.ctx = nullptr;
+
         workers[i] = std::thread(whisper_full_with_state, ctx, states[i], std::move(params_cur), samples + start_samples, n_samples_cur);
     }
 
@@ -5986,11 +7863,11 @@ int whisper_full_n_tokens(struct whisper_context * ctx, int i_segment) {
 }
 
 const char * whisper_full_get_token_text_from_state(struct whisper_context * ctx, struct whisper_state * state, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_text(state->result_all[i_segment].tokens[i_token].id);
 }
 
 const char* whisper_full_get_token_text(struct whisper_context * ctx, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[ctx->state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_text(ctx->state->result_all[i_segment].tokens[i_token].id);
 }
 
 whisper_token whisper_full_get_token_id_from_state(struct whisper_state * state, int i_segment, int i_token) {
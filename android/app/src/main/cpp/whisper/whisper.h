@@ -79,6 +79,7 @@ extern "C" {
     struct whisper_context;
     struct whisper_state;
     struct whisper_full_params;
+    struct whisper_mel_stream;
 
     typedef int32_t whisper_pos;
     typedef int32_t whisper_token;
@@ -86,6 +87,21 @@ extern "C" {
 
     struct whisper_context_params {
         bool  use_gpu;
+        bool  use_mmap; // map the model file and use the weights in place (CPU backend, whisper_init_from_file_* only)
+        bool  use_perf_cores; // keep the compute threads on the performance cores of big.LITTLE CPUs (Linux/Android)
+
+        // storage type of the attention KV caches: GGML_TYPE_F16, or GGML_TYPE_Q8_0 / GGML_TYPE_Q4_0 to keep the keys
+        // and the cross-attention values in 8/4-bit blocks (CPU backend only, the self-attention values stay F16)
+        enum ggml_type kv_type;
+
+        // upper bound on the cells of the self-attention KV cache, which is sized for the number of decoders that
+        // whisper_full() runs (0 = 3*n_text_ctx)
+        int kv_self_max;
+
+        // bound on the cache of encoder results shared by the states of the context: the cross-attention K/V of
+        // recently encoded audio windows, so that decoding the same audio again skips the encoder (0 = disabled)
+        // each entry also holds its mel window (up to ~1 MB), which a hit must match exactly
+        size_t cross_cache_bytes;
     };
 
     typedef struct whisper_token_data {
@@ -256,6 +272,42 @@ extern "C" {
                                int   n_len,
                                int   n_mel);
 
+    // Incremental log mel spectrogram for streaming audio.
+    // Push 16 kHz mono PCM as it arrives: every mel frame is computed once, as soon as all of its samples are in.
+    // whisper_mel_stream_set() then builds the normalized spectrogram of the samples [t0, t1) of the stream, as
+    // whisper_pcm_to_mel() would for that audio, reusing the cached frames. Call whisper_full() with n_samples = 0
+    // to transcribe it. Positions are in samples since the first push.
+    // Unlike whisper_pcm_to_mel(), the first frames of a window see the audio before t0 instead of a reflection.
+    // The stream keeps a copy of the mel filters, so it stays valid if the context is freed.
+    WHISPER_API struct whisper_mel_stream * whisper_mel_stream_init(struct whisper_context * ctx);
+    WHISPER_API void whisper_mel_stream_free(struct whisper_mel_stream * ms);
+
+    // Returns the total number of samples pushed so far
+    WHISPER_API int64_t whisper_mel_stream_push(
+         struct whisper_mel_stream * ms,
+                       const float * samples,
+                               int   n_samples);
+
+    // Frees the audio and frames that windows starting at t0 or later do not need
+    WHISPER_API void whisper_mel_stream_discard(
+         struct whisper_mel_stream * ms,
+                           int64_t   t0);
+
+    // t0 is rounded down to a multiple of WHISPER_HOP_LENGTH and t1 is capped at the audio pushed so far
+    // Returns 0 on success
+    WHISPER_API int whisper_mel_stream_set(
+            struct whisper_context * ctx,
+         struct whisper_mel_stream * ms,
+                           int64_t   t0,
+                           int64_t   t1);
+
+    WHISPER_API int whisper_mel_stream_set_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+         struct whisper_mel_stream * ms,
+                           int64_t   t0,
+                           int64_t   t1);
+
     // Run the Whisper encoder on the log mel spectrogram stored inside the default state in the provided whisper context.
     // Make sure to call whisper_pcm_to_mel() or whisper_set_mel() first.
     // offset can be used to specify the offset of the first frame in the spectrogram.
@@ -344,6 +396,11 @@ extern "C" {
     WHISPER_API int whisper_n_audio_ctx     (struct whisper_context * ctx);
     WHISPER_API int whisper_is_multilingual (struct whisper_context * ctx);
 
+    // Reduced encoder context (for whisper_full_params.audio_ctx) that covers n_samples of audio with a safety margin
+    // The encoder cost scales with the context, so short utterances run several times faster than with the full 30 s
+    // Returns 0 if the full context is needed
+    WHISPER_API int whisper_audio_ctx_for_samples(struct whisper_context * ctx, int n_samples);
+
     WHISPER_API int whisper_model_n_vocab      (struct whisper_context * ctx);
     WHISPER_API int whisper_model_n_audio_ctx  (struct whisper_context * ctx);
     WHISPER_API int whisper_model_n_audio_state(struct whisper_context * ctx);
@@ -390,6 +447,12 @@ extern "C" {
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
+    // The CPUs whisper treats as performance cores: on big.LITTLE CPUs the ones faster than the slowest cluster,
+    // ranked by cpu_capacity or cpuinfo_max_freq in sysfs; every CPU otherwise.
+    // whisper_full_default_params() uses up to 4 of them, and with use_perf_cores the compute threads stay on them.
+    // Writes up to n_max CPU numbers to cpus and returns how many there are.
+    WHISPER_API int whisper_cpu_performance_cores(int * cpus, int n_max);
+
     ////////////////////////////////////////////////////////////////////////////
 
     // Available sampling strategies
@@ -523,6 +586,14 @@ extern "C" {
         size_t                           n_grammar_rules;
         size_t                           i_start_rule;
         float                            grammar_penalty;
+
+        // speculative decoding, used for greedy sampling at temperature 0
+        // the draft model proposes up to n_draft tokens that are verified with a single batched decoder call
+        // the draft must share the vocabulary and the mel bins of the model, and its default state is used
+        struct {
+            struct whisper_context * ctx; // nullptr = disabled
+            int n_draft;
+        } draft;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
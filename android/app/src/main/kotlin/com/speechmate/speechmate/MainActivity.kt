@@ -1,36 +1,226 @@
 package com.speechmate.speechmate
 
+import android.content.ComponentCallbacks2
 import androidx.annotation.NonNull
 import io.flutter.embedding.android.FlutterActivity
 import io.flutter.embedding.engine.FlutterEngine
 import io.flutter.plugin.common.MethodChannel
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.ExecutorService
+import java.util.concurrent.Executors
 
 class MainActivity: FlutterActivity() {
     private val CHANNEL = "speechmate/whisper"
+    private var channel: MethodChannel? = null
+
+    // Native calls block until the transcription is done, so they run here instead of on the
+    // main thread. The native engine bounds how many of them actually run at once.
+    private val whisperExecutor: ExecutorService = Executors.newCachedThreadPool()
 
     // Declare the native method
     external fun transcribe(modelPath: String, audioPath: String): String
 
+    // Resident model handles (0 = failed to load)
+    external fun initModel(modelPath: String, maxConcurrent: Int): Long
+    external fun transcribeWithModel(handle: Long, audioPath: String): String
+    external fun releaseModel(handle: Long)
+    external fun setAudioCtx(handle: Long, audioCtx: Int)
+
+    // Dummy decode on silence so the first real transcription runs warm.
+    // Returns the time it took in microseconds, 0 if already warm, -1 on failure.
+    external fun warmupModel(handle: Long): Long
+    // [t_load_us, t_warmup_us, t_first_us, first_was_warm, n_transcriptions]
+    external fun modelTimings(handle: Long): LongArray?
+
+    // 16-bit mono PCM straight from memory, no temp WAV file. The ByteBuffer must be direct.
+    external fun transcribePcmBuffer(handle: Long, buffer: ByteBuffer, numSamples: Int, sampleRate: Int): String
+    external fun transcribePcmShorts(handle: Long, samples: ShortArray, sampleRate: Int): String
+
+    // Streaming sessions: segments arrive on a native thread through onStreamSegment
+    external fun streamOpen(handle: Long, sampleRate: Int, stepMs: Int, lengthMs: Int): Long
+    external fun streamPush(stream: Long, samples: ShortArray): Int
+    external fun streamPoll(stream: Long): Array<String>?
+    external fun streamClose(stream: Long): String
+    external fun trimMemory(): Int
+
+    // whisper_print_system_info() and the performance cores the compute threads run on
+    external fun systemInfo(): String
+    external fun performanceCores(): IntArray?
+
     override fun configureFlutterEngine(@NonNull flutterEngine: FlutterEngine) {
         super.configureFlutterEngine(flutterEngine)
-        
-        MethodChannel(flutterEngine.dartExecutor.binaryMessenger, CHANNEL).setMethodCallHandler { call, result ->
-            if (call.method == "transcribe") {
-                val modelPath = call.argument<String>("model")
-                val audioPath = call.argument<String>("audio")
-
-                if (modelPath != null && audioPath != null) {
-                    val text = transcribe(modelPath, audioPath)
-                    result.success(text)
-                } else {
-                    result.error("INVALID_ARGUMENT", "Model path or audio path is null", null)
-                }
-            } else {
-                result.notImplemented()
+
+        channel = MethodChannel(flutterEngine.dartExecutor.binaryMessenger, CHANNEL)
+        channel!!.setMethodCallHandler { call, result ->
+            when (call.method) {
+                "transcribe" -> {
+                    val modelPath = call.argument<String>("model")
+                    val audioPath = call.argument<String>("audio")
+
+                    if (modelPath != null && audioPath != null) {
+                        runInBackground(result) { transcribe(modelPath, audioPath) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Model path or audio path is null", null)
+                    }
+                }
+                "initModel" -> {
+                    val modelPath = call.argument<String>("model")
+                    val maxConcurrent = call.argument<Int>("maxConcurrent") ?: 2
+
+                    if (modelPath != null) {
+                        runInBackground(result) { initModel(modelPath, maxConcurrent) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Model path is null", null)
+                    }
+                }
+                "transcribeWithModel" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+                    val audioPath = call.argument<String>("audio")
+
+                    if (handle != null && audioPath != null) {
+                        runInBackground(result) { transcribeWithModel(handle, audioPath) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Handle or audio path is null", null)
+                    }
+                }
+                "transcribePcm" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+                    val pcm = call.argument<ByteArray>("pcm")
+                    val sampleRate = call.argument<Int>("sampleRate") ?: 16000
+
+                    if (handle != null && pcm != null) {
+                        runInBackground(result) { transcribePcmShorts(handle, pcm.toShorts(), sampleRate) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Handle or PCM data is null", null)
+                    }
+                }
+                "streamOpen" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+                    val sampleRate = call.argument<Int>("sampleRate") ?: 16000
+                    val stepMs = call.argument<Int>("stepMs") ?: 500
+                    val lengthMs = call.argument<Int>("lengthMs") ?: 5000
+
+                    if (handle != null) {
+                        runInBackground(result) { streamOpen(handle, sampleRate, stepMs, lengthMs) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Handle is null", null)
+                    }
+                }
+                "streamPush" -> {
+                    val stream = call.argument<Number>("stream")?.toLong()
+                    val pcm = call.argument<ByteArray>("pcm")
+
+                    if (stream != null && pcm != null) {
+                        // Only queues the samples, so it is cheap enough for the UI thread.
+                        result.success(streamPush(stream, pcm.toShorts()))
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Stream or PCM data is null", null)
+                    }
+                }
+                "streamPoll" -> {
+                    val stream = call.argument<Number>("stream")?.toLong()
+
+                    val texts = if (stream != null) streamPoll(stream) else null
+                    result.success(texts?.let { mapOf("final" to it[0], "partial" to it[1]) })
+                }
+                "streamClose" -> {
+                    val stream = call.argument<Number>("stream")?.toLong()
+
+                    if (stream != null) {
+                        runInBackground(result) { streamClose(stream) }
+                    } else {
+                        result.success("")
+                    }
+                }
+                "warmupModel" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+
+                    if (handle != null) {
+                        runInBackground(result) { warmupModel(handle) }
+                    } else {
+                        result.error("INVALID_ARGUMENT", "Handle is null", null)
+                    }
+                }
+                "modelTimings" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+
+                    val timings = if (handle != null) modelTimings(handle) else null
+                    result.success(timings?.let {
+                        mapOf(
+                            "loadUs" to it[0],
+                            "warmupUs" to it[1],
+                            "firstUs" to it[2],
+                            "firstWasWarm" to (it[3] != 0L),
+                            "transcriptions" to it[4]
+                        )
+                    })
+                }
+                "cpuInfo" -> {
+                    result.success(mapOf(
+                        "systemInfo" to systemInfo(),
+                        "performanceCores" to (performanceCores()?.toList() ?: emptyList<Int>())
+                    ))
+                }
+                "setAudioCtx" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+                    val audioCtx = call.argument<Int>("audioCtx") ?: -1
+
+                    if (handle != null) {
+                        setAudioCtx(handle, audioCtx)
+                    }
+                    result.success(null)
+                }
+                "releaseModel" -> {
+                    val handle = call.argument<Number>("handle")?.toLong()
+
+                    if (handle != null) {
+                        runInBackground(result) { releaseModel(handle) }
+                    } else {
+                        result.success(null)
+                    }
+                }
+                else -> result.notImplemented()
             }
         }
     }
 
+    private fun runInBackground(result: MethodChannel.Result, task: () -> Any?) {
+        whisperExecutor.execute {
+            val value = task()
+            runOnUiThread { result.success(value) }
+        }
+    }
+
+    // Called from the native stream worker thread
+    @Suppress("unused")
+    fun onStreamSegment(stream: Long, seq: Long, text: String, isFinal: Boolean) {
+        runOnUiThread {
+            channel?.invokeMethod("streamSegment", mapOf(
+                "stream" to stream,
+                "seq" to seq,
+                "text" to text,
+                "isFinal" to isFinal
+            ))
+        }
+    }
+
+    // Little-endian 16-bit PCM bytes (as the recorder emits them) to samples
+    private fun ByteArray.toShorts(): ShortArray {
+        val samples = ShortArray(size / 2)
+        ByteBuffer.wrap(this).order(ByteOrder.LITTLE_ENDIAN).asShortBuffer().get(samples)
+        return samples
+    }
+
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+
+        // Drop idle models when the system is short on memory; they reload on the next transcription.
+        if (level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL || level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND) {
+            trimMemory()
+        }
+    }
+
     companion object {
         init {
             System.loadLibrary("whisper-lib")
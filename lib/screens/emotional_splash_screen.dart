@@ -4,6 +4,7 @@ import 'dart:ui' as ui;
 import 'package:flutter/services.dart';
 import 'package:speechmate/screens/app_language_select.dart';
 import 'package:speechmate/screens/languages.dart';
+import 'package:speechmate/services/whisper_service.dart';
 
 class EmotionalSplashScreen extends StatefulWidget {
   final Widget nextScreen;
@@ -34,6 +35,10 @@ class _EmotionalSplashScreenState extends State<EmotionalSplashScreen> with Tick
   @override
   void initState() {
     super.initState();
+
+    // Load and warm up the speech model while the intro plays, so the first
+    // voice search does not pay for it. Runs on a native worker thread.
+    WhisperService.preloadBundledModel();
     
     // Initialize Particles with Physics properties
     for (int i = 0; i < particleCount; i++) {
@@ -1,18 +1,231 @@
 import 'package:flutter/services.dart';
 import 'package:flutter/foundation.dart';
+import 'package:ffi/ffi.dart';
+import 'dart:ffi';
+import 'dart:async';
 import 'dart:io';
+import 'dart:isolate';
+import 'dart:typed_data';
+import 'package:path_provider/path_provider.dart';
+
+typedef _TranscribePcm16Native = Pointer<Utf8> Function(
+    Int64 handle, Pointer<Int16> samples, Int32 nSamples, Int32 sampleRate);
+typedef _TranscribePcm16 = Pointer<Utf8> Function(
+    int handle, Pointer<Int16> samples, int nSamples, int sampleRate);
+typedef _FreeTextNative = Void Function(Pointer<Utf8> text);
+typedef _FreeText = void Function(Pointer<Utf8> text);
+
+/// A partial or finalized piece of text from a [WhisperStream].
+class WhisperSegment {
+  final int seq;
+  final String text;
+  final bool isFinal;
+
+  const WhisperSegment(this.seq, this.text, this.isFinal);
+}
+
+/// A live transcription session: PCM goes in while recording, segments come
+/// out every step (~500 ms) instead of only after the recording stops.
+///
+/// Each segment is the text of the current window. Partial segments are
+/// replaced by the next one; finalized segments are appended to [finalText].
+class WhisperStream {
+  final int _id;
+  final StreamController<WhisperSegment> _segments =
+      StreamController<WhisperSegment>.broadcast();
+
+  String finalText = "";
+  String partialText = "";
+
+  WhisperStream._(this._id);
+
+  Stream<WhisperSegment> get segments => _segments.stream;
+
+  /// Everything heard so far, finalized text first.
+  String get text => finalText + partialText;
+
+  void _onSegment(WhisperSegment segment) {
+    if (segment.isFinal) {
+      finalText += segment.text;
+      partialText = "";
+    } else {
+      partialText = segment.text;
+    }
+    _segments.add(segment);
+  }
+
+  /// Queues 16-bit little-endian mono PCM; returns immediately.
+  Future<void> push(Uint8List pcm) async {
+    final int dropped = await WhisperService._channel.invokeMethod(
+        'streamPush', {'stream': _id, 'pcm': pcm}) ?? -1;
+    if (dropped > 0) {
+      debugPrint("Whisper: stream fell behind, $dropped samples dropped.");
+    }
+  }
+
+  /// Transcribes what is still queued and ends the session.
+  /// Returns the complete text.
+  Future<String> close() async {
+    WhisperService._streams.remove(_id);
+    try {
+      final String text = await WhisperService._channel.invokeMethod(
+          'streamClose', {'stream': _id}) ?? "";
+      return text;
+    } finally {
+      await _segments.close();
+    }
+  }
+}
 
 class WhisperService {
   static const _channel = MethodChannel('speechmate/whisper');
-  bool _isProcessing = false;
 
-  Future<String> transcribe(String modelPath, String audioPath) async {
-    if (_isProcessing) {
-      debugPrint("Whisper: Already processing a request. Ignored.");
-      return "";
+  /// The model bundled with the app, copied out of the assets on first use.
+  static const String bundledModelAsset = 'assets/models/ggml-tiny.en.bin';
+
+  /// Completes with true once the bundled model is loaded and warmed up
+  /// (see [preloadBundledModel]), or false if that failed.
+  static final ValueNotifier<bool?> ready = ValueNotifier<bool?>(null);
+  static Future<bool>? _preload;
+
+  // Open streaming sessions by native id, to route segment callbacks.
+  static final Map<int, WhisperStream> _streams = {};
+  static bool _handlerInstalled = false;
+
+  // How many transcriptions may run at once on one loaded model. Each one
+  // needs its own native decoder state (tens of MB), but shares the weights.
+  static const int maxConcurrent = 2;
+
+  // Native model handles, shared by every WhisperService instance.
+  // The model stays loaded in native memory until unloadModel() is called.
+  static final Map<String, int> _handles = {};
+
+  // Loads in flight by model path. Callers that overlap (splash preload,
+  // first transcription, stream) share one, so that the native model is
+  // acquired once per handle and unloadModel() can free it.
+  static final Map<String, Future<bool>> _loading = {};
+
+  /// Loads the model once and keeps it resident for later transcriptions.
+  /// Returns false if the native side could not load it.
+  static Future<bool> loadModel(String modelPath) {
+    if (_handles.containsKey(modelPath)) return Future.value(true);
+
+    return _loading[modelPath] ??=
+        _initModel(modelPath).whenComplete(() => _loading.remove(modelPath));
+  }
+
+  static Future<bool> _initModel(String modelPath) async {
+    final int handle = await _channel.invokeMethod('initModel', {
+      'model': modelPath,
+      'maxConcurrent': maxConcurrent,
+    }) ?? 0;
+    if (handle == 0) {
+      debugPrint("Whisper: Failed to load model at $modelPath");
+      return false;
+    }
+    _handles[modelPath] = handle;
+    return true;
+  }
+
+  /// Short-utterance mode (on by default): the encoder only processes as
+  /// much context as the audio needs instead of a fixed 30 s window, which
+  /// makes 1-5 s words several times faster. Results that decode poorly are
+  /// redone with the full window.
+  static Future<void> setShortUtteranceMode(String modelPath, bool enabled) async {
+    final handle = _handles[modelPath];
+    if (handle != null) {
+      await _channel.invokeMethod('setAudioCtx', {
+        'handle': handle,
+        'audioCtx': enabled ? -1 : 0,
+      });
+    }
+  }
+
+  /// Runs a dummy transcription on silence so that the first real one does
+  /// not pay for native graph allocation, page faults on the weights and cold
+  /// caches. Loads the model if needed. Cheap if it is already warm.
+  static Future<bool> warmupModel(String modelPath) async {
+    if (!await loadModel(modelPath)) return false;
+
+    try {
+      final int us = await _channel.invokeMethod('warmupModel', {
+        'handle': _handles[modelPath],
+      }) ?? -1;
+      if (us < 0) {
+        debugPrint("Whisper: Warm-up failed for $modelPath");
+        return false;
+      }
+      if (us > 0) {
+        debugPrint("Whisper: Warmed up in ${us ~/ 1000} ms.");
+      }
+      return true;
+    } on PlatformException catch (e) {
+      debugPrint("Whisper Error: ${e.code} - ${e.message}");
+      return false;
+    }
+  }
+
+  /// Copies the bundled model out of the assets if needed and returns its
+  /// path on disk.
+  static Future<String> bundledModelPath() async {
+    final Directory appDocDir = await getApplicationDocumentsDirectory();
+    final String modelPath = '${appDocDir.path}/ggml-tiny.en.bin';
+
+    if (!File(modelPath).existsSync()) {
+      try {
+        final ByteData data = await rootBundle.load(bundledModelAsset);
+        await File(modelPath).writeAsBytes(data.buffer.asUint8List());
+      } catch (e) {
+        debugPrint("Error copying model: $e");
+      }
+    }
+    return modelPath;
+  }
+
+  /// Loads and warms up the bundled model in the background, e.g. while the
+  /// splash screen plays. Safe to call more than once; [ready] reports the
+  /// outcome.
+  static Future<bool> preloadBundledModel() {
+    return _preload ??= () async {
+      final bool ok = await warmupModel(await bundledModelPath());
+      ready.value = ok;
+      return ok;
+    }();
+  }
+
+  /// Load, warm-up and first-transcription latency for [modelPath], to
+  /// compare cold and warm first calls. Null if the model is not loaded.
+  static Future<Map<String, Object?>?> modelTimings(String modelPath) async {
+    final handle = _handles[modelPath];
+    if (handle == null) return null;
+
+    final Map? timings =
+        await _channel.invokeMethod('modelTimings', {'handle': handle});
+    return timings?.cast<String, Object?>();
+  }
+
+  /// Native build flags and CPU topology: `systemInfo` is whisper's system
+  /// info line, `performanceCores` the CPUs inference threads are kept on.
+  static Future<Map<String, Object?>?> cpuInfo() async {
+    final Map? info = await _channel.invokeMethod('cpuInfo');
+    return info?.cast<String, Object?>();
+  }
+
+  static Future<void> unloadModel(String modelPath) async {
+    final handle = _handles.remove(modelPath);
+    if (handle != null) {
+      await _channel.invokeMethod('releaseModel', {'handle': handle});
     }
-    
-    // Check files on main isolate before spawning
+  }
+
+  /// Transcribes a 16 kHz WAV file.
+  ///
+  /// Several calls may be in flight at once; the native side runs up to
+  /// [maxConcurrent] of them in parallel and queues a few more. When that
+  /// queue is full the call fails fast with "Error: Transcriber busy"
+  /// rather than being silently dropped.
+  Future<String> transcribe(String modelPath, String audioPath) async {
+    // Check files before handing the paths to native code
     if (!await File(modelPath).exists()) {
         return "Error: Model file not found at $modelPath";
     }
@@ -20,36 +233,143 @@ class WhisperService {
         return "Error: Audio file not found at $audioPath";
     }
 
-    _isProcessing = true;
     try {
-      // Run native call in background isolate
-      final token = RootIsolateToken.instance!;
-      final String text = await compute(_transcribeInBackground, {
-        'model': modelPath,
-        'audio': audioPath,
-        'token': token,
-      });
-      
-      _isProcessing = false;
-      return text;
+      // The native call runs on a worker thread in MainActivity, so awaiting
+      // it here does not block the UI isolate.
+      final handle = _handles[modelPath];
+      final String? text = handle != null
+          ? await _channel.invokeMethod('transcribeWithModel', {
+              'handle': handle,
+              'audio': audioPath,
+            })
+          : await _channel.invokeMethod('transcribe', {
+              'model': modelPath,
+              'audio': audioPath,
+            });
+
+      if (text != null && text.startsWith("Error: Transcriber busy")) {
+        debugPrint("Whisper: Too many requests in flight, rejected.");
+      }
+      return text ?? "";
     } on PlatformException catch (e) {
-      _isProcessing = false;
       debugPrint("Whisper Error: ${e.code} - ${e.message}");
       return "Error: Could not transcribe. Details: ${e.message}";
     } catch (e) {
-        _isProcessing = false;
         debugPrint("Whisper Unexpected Error: $e");
         return "Error: $e";
     }
   }
 
-  // Top-level function for compute
-  static Future<String> _transcribeInBackground(Map<String, dynamic> params) async {
-     BackgroundIsolateBinaryMessenger.ensureInitialized(params['token'] as RootIsolateToken);
-     const channel = MethodChannel('speechmate/whisper');
-     return await channel.invokeMethod('transcribe', {
-        'model': params['model'], 
-        'audio': params['audio']
-     });
+  /// Transcribes 16-bit little-endian mono PCM held in memory, e.g. what the
+  /// recorder streams, without writing or reading a WAV file.
+  ///
+  /// On Android the samples go to native code over FFI: they are copied once
+  /// into native memory and the blocking call runs on a background isolate.
+  /// The method channel is only used as a fallback.
+  Future<String> transcribePcm(String modelPath, Uint8List pcm,
+      {int sampleRate = 16000}) async {
+    if (!await File(modelPath).exists()) {
+        return "Error: Model file not found at $modelPath";
+    }
+    if (!await loadModel(modelPath)) {
+        return "Error: Failed to initialize whisper context";
+    }
+    final int handle = _handles[modelPath]!;
+    final int nSamples = pcm.length ~/ 2;
+
+    String text;
+    try {
+      text = await _transcribePcmFfi(handle, pcm, nSamples, sampleRate);
+    } on ArgumentError catch (e) {
+      // Symbols missing from the native library: use the method channel.
+      debugPrint("Whisper: FFI unavailable ($e), using method channel.");
+      try {
+        text = await _channel.invokeMethod('transcribePcm', {
+          'handle': handle,
+          'pcm': pcm,
+          'sampleRate': sampleRate,
+        }) ?? "";
+      } on PlatformException catch (e) {
+        debugPrint("Whisper Error: ${e.code} - ${e.message}");
+        return "Error: Could not transcribe. Details: ${e.message}";
+      } catch (e) {
+        debugPrint("Whisper Unexpected Error: $e");
+        return "Error: $e";
+      }
+    } catch (e) {
+        debugPrint("Whisper Unexpected Error: $e");
+        return "Error: $e";
+    }
+
+    if (text.startsWith("Error: Transcriber busy")) {
+      debugPrint("Whisper: Too many requests in flight, rejected.");
+    }
+    return text;
+  }
+
+  /// Starts a streaming session on [modelPath], loading the model if needed.
+  /// Returns null if the session could not be opened.
+  static Future<WhisperStream?> openStream(String modelPath,
+      {int sampleRate = 16000, int stepMs = 500, int lengthMs = 5000}) async {
+    if (!await loadModel(modelPath)) return null;
+
+    if (!_handlerInstalled) {
+      _channel.setMethodCallHandler(_onNativeCall);
+      _handlerInstalled = true;
+    }
+
+    try {
+      final int id = await _channel.invokeMethod('streamOpen', {
+        'handle': _handles[modelPath],
+        'sampleRate': sampleRate,
+        'stepMs': stepMs,
+        'lengthMs': lengthMs,
+      }) ?? 0;
+      if (id == 0) return null;
+
+      final stream = WhisperStream._(id);
+      _streams[id] = stream;
+      return stream;
+    } on PlatformException catch (e) {
+      debugPrint("Whisper Error: ${e.code} - ${e.message}");
+      return null;
+    }
+  }
+
+  static Future<void> _onNativeCall(MethodCall call) async {
+    if (call.method == 'streamSegment') {
+      final args = call.arguments as Map;
+      _streams[args['stream'] as int]?._onSegment(WhisperSegment(
+          args['seq'] as int, args['text'] as String, args['isFinal'] as bool));
+    }
+  }
+
+  static Future<String> _transcribePcmFfi(
+      int handle, Uint8List pcm, int nSamples, int sampleRate) async {
+    final Pointer<Int16> samples = malloc<Int16>(nSamples > 0 ? nSamples : 1);
+    try {
+      samples.cast<Uint8>().asTypedList(nSamples * 2)
+          .setRange(0, nSamples * 2, pcm);
+
+      // Only the address crosses the isolate boundary, not the samples.
+      final int address = samples.address;
+      return await Isolate.run(() {
+        final lib = DynamicLibrary.open('libwhisper-lib.so');
+        final transcribe = lib.lookupFunction<_TranscribePcm16Native,
+            _TranscribePcm16>('speechmate_transcribe_pcm16');
+        final freeText = lib.lookupFunction<_FreeTextNative, _FreeText>(
+            'speechmate_free_text');
+
+        final Pointer<Utf8> result = transcribe(
+            handle, Pointer<Int16>.fromAddress(address), nSamples, sampleRate);
+        try {
+          return result.toDartString();
+        } finally {
+          freeText(result);
+        }
+      });
+    } finally {
+      malloc.free(samples);
+    }
   }
 }
@@ -1,7 +1,5 @@
 import 'dart:io';
 import 'package:flutter/material.dart';
-import 'package:flutter/services.dart'; // For rootBundle/AssetBundle
-import 'package:path_provider/path_provider.dart';
 import 'package:record/record.dart';
 import 'package:speechmate/services/whisper_service.dart';
 import 'ai_assistant_overlay.dart';
@@ -25,6 +23,16 @@ class VoiceAssistantDialog extends StatefulWidget {
 
 class _VoiceAssistantDialogState extends State<VoiceAssistantDialog> {
   final AudioRecorder _audioRecorder = AudioRecorder();
+
+  // Raw 16 kHz PCM streamed from the recorder, kept in memory and handed to
+  // Whisper directly instead of going through a temp WAV file.
+  final BytesBuilder _pcm = BytesBuilder(copy: false);
+  Future<void>? _pcmDone; // completes once the recorder closes the stream
+
+  // Live session showing words while the user is still speaking. When it
+  // cannot be opened, the PCM is buffered instead and transcribed in one go
+  // on stop.
+  WhisperStream? _stream;
   
   bool _isRecording = false;
   String _aiText = "Listening..."; // Initial State
@@ -38,41 +46,39 @@ class _VoiceAssistantDialogState extends State<VoiceAssistantDialog> {
 
   @override
   void dispose() {
+    _stream?.close();
     _audioRecorder.dispose();
     super.dispose();
   }
 
-  Future<String> _getModelPath() async {
-     final Directory appDocDir = await getApplicationDocumentsDirectory();
-     final String modelPath = '${appDocDir.path}/ggml-tiny.en.bin';
-     
-     if (!File(modelPath).existsSync()) {
-       try {
-         final ByteData data = await DefaultAssetBundle.of(context).load('assets/models/ggml-tiny.en.bin');
-         final List<int> bytes = data.buffer.asUint8List();
-         await File(modelPath).writeAsBytes(bytes);
-       } catch (e) {
-         debugPrint("Error copying model: $e");
-       }
-     }
-     return modelPath;
-  }
+  Future<String> _getModelPath() => WhisperService.bundledModelPath();
 
   Future<void> _startRecording() async {
     try {
       if (await _audioRecorder.hasPermission()) {
-        final Directory appDocDir = await getApplicationDocumentsDirectory();
-        final String filePath = '${appDocDir.path}/temp_voice_search.wav';
-        
         // Ensure clean slate
-        if (File(filePath).existsSync()) {
-            File(filePath).deleteSync();
-        }
+        _pcm.clear();
 
-        await _audioRecorder.start(
-          const RecordConfig(encoder: AudioEncoder.wav, sampleRate: 16000, numChannels: 1), 
-          path: filePath
+        final modelPath = await _getModelPath();
+        _stream = await WhisperService.openStream(modelPath);
+        _stream?.segments.listen((_) {
+          if (mounted && _isRecording) {
+            final heard = _stream?.text.replaceAll("[BLANK_AUDIO]", "").trim() ?? "";
+            if (heard.isNotEmpty) setState(() => _aiText = heard);
+          }
+        });
+
+        final stream = await _audioRecorder.startStream(
+          const RecordConfig(encoder: AudioEncoder.pcm16bits, sampleRate: 16000, numChannels: 1)
         );
+        _pcmDone = stream.forEach((chunk) {
+          final live = _stream;
+          if (live != null) {
+            live.push(chunk);
+          } else {
+            _pcm.add(chunk);
+          }
+        });
         
         setState(() {
           _isRecording = true;
@@ -86,12 +92,19 @@ class _VoiceAssistantDialogState extends State<VoiceAssistantDialog> {
 
   Future<void> _stopRecording() async {
     try {
-      final path = await _audioRecorder.stop();
+      await _audioRecorder.stop();
+      await _pcmDone; // the last chunks arrive before the stream closes
+      _pcmDone = null;
       setState(() { _isRecording = false; _aiText = "Thinking..."; });
 
-      if (path != null) {
+      final pcm = _pcm.takeBytes();
+      final liveStream = _stream;
+      _stream = null;
+      if (liveStream != null || pcm.isNotEmpty) {
         final modelPath = await _getModelPath();
-        final text = await WhisperService().transcribe(modelPath, path);
+        final text = liveStream != null
+            ? await liveStream.close()
+            : await WhisperService().transcribePcm(modelPath, pcm);
         
         if (text.startsWith("Error")) {
            setState(() => _aiText = "Oops! I didn't catch that.");